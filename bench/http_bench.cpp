@@ -0,0 +1,359 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <unistd.h>
+#include "../include/networking/HTTP/HTTP.hpp"
+
+// Counters bumped by every allocation, the benchmarks are single threaded so they aren't atomic.
+static uint64_t allocations = 0;
+static uint64_t allocated_bytes = 0;
+
+/**
+ * @brief Counts an allocation then takes it from malloc.
+ * @param size The bytes wanted.
+ * @return The memory.
+ * @note Not inlined, so GCC never sees malloc and free meet the replaced operators and warn they don't match.
+ */
+__attribute__((noinline)) static void* counted_allocate(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+/**
+ * @brief Gives memory from counted_allocate back to malloc.
+ * @param memory The memory.
+ */
+__attribute__((noinline)) static void counted_free(void* memory) {
+    free(memory);
+}
+
+void* operator new(size_t size) {
+    return counted_allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return counted_allocate(size);
+}
+
+void operator delete(void* memory) noexcept {
+    counted_free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    counted_free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    counted_free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    counted_free(memory);
+}
+
+/**
+ * @brief Stops the compiler from optimizing away a value that is never used.
+ * @param value The value.
+ */
+template <typename T>
+static void keep(T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * @struct Options
+ * @brief What to run and for how long.
+ */
+struct Options {
+    std::string filter; ///< Only benchmarks whose name contains this are run.
+    double target_ms = 200; ///< Roughly how long each benchmark runs for.
+};
+
+/**
+ * @brief Runs a benchmark long enough to time it and prints its cost per operation.
+ * @param options What to run and for how long.
+ * @param name The name of the benchmark.
+ * @param body One operation.
+ */
+template <typename F>
+static void run(const Options& options, const std::string& name, F&& body) {
+    // Skip benchmarks that weren't asked for.
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+        return;
+    }
+
+    // Grow the iterations until a run takes a tenth of the target, which also warms up caches.
+    uint64_t iterations = 1;
+    double elapsed_ns = 0;
+    while (true) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            body();
+        }
+        elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed_ns >= options.target_ms * 1e5 || iterations >= (1ULL << 32)) {
+            break;
+        }
+        iterations *= 10;
+    }
+
+    // Scale up to fill the target and measure.
+    iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * (options.target_ms * 1e6) / std::max(elapsed_ns, 1.0)));
+    uint64_t allocations_before = allocations;
+    uint64_t bytes_before = allocated_bytes;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+        body();
+    }
+    elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // Report the cost of one operation.
+    std::cout << std::left << std::setw(36) << name << std::right
+              << std::setw(12) << iterations
+              << std::setw(12) << std::fixed << std::setprecision(1) << elapsed_ns / iterations
+              << std::setw(12) << std::setprecision(2) << static_cast<double>(allocations - allocations_before) / iterations
+              << std::setw(12) << std::setprecision(1) << static_cast<double>(allocated_bytes - bytes_before) / iterations
+              << std::endl;
+}
+
+static const std::string HOST = "127.0.0.1:8080";
+
+static std::string small_get() {
+    // The least a client can send.
+    return "GET / HTTP/1.1\r\nHost: " + HOST + "\r\n\r\n";
+}
+
+static std::string browser_get() {
+    // What a browser sends for a page.
+    return "GET /about HTTP/1.1\r\n"
+           "Host: " + HOST + "\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 Firefox/131.0\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+           "Accept-Language: en-GB,en;q=0.5\r\n"
+           "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+           "Connection: keep-alive\r\n"
+           "Upgrade-Insecure-Requests: 1\r\n"
+           "Sec-Fetch-Dest: document\r\n"
+           "Sec-Fetch-Mode: navigate\r\n"
+           "Sec-Fetch-Site: none\r\n"
+           "Priority: u=0, i\r\n"
+           "\r\n";
+}
+
+static std::string cookie_get() {
+    // A page request carrying about 4 KiB of cookies.
+    std::string cookie;
+    for (int i = 0; i < 48; i++) {
+        cookie += (i == 0 ? "" : "; ") + std::string("session_") + std::to_string(i) + "=" + std::string(72, static_cast<char>('a' + i % 26));
+    }
+    return "GET /about HTTP/1.1\r\nHost: " + HOST + "\r\nUser-Agent: bench\r\nCookie: " + cookie + "\r\n\r\n";
+}
+
+static std::string many_headers_get() {
+    // Close to the most headers a request can have.
+    std::string raw = "GET /about HTTP/1.1\r\nHost: " + HOST + "\r\n";
+    for (int i = 0; i < 60; i++) {
+        raw += "X-Forwarded-Custom-" + std::to_string(i) + ": value-" + std::to_string(i * 7919) + "\r\n";
+    }
+    return raw + "\r\n";
+}
+
+static std::string deep_get() {
+    // A route ten levels down.
+    return "GET /a/b/c/d/e/f/g/h/i/page HTTP/1.1\r\nHost: " + HOST + "\r\nAccept: */*\r\n\r\n";
+}
+
+/**
+ * @class Site
+ * @brief A website structure and page in a temp directory for the routing benchmarks, removed when destroyed.
+ */
+class Site {
+    public:
+        std::string directory; ///< The temp directory.
+        std::string structure; ///< The path of the structure file.
+        std::string page; ///< The path of the page every route serves.
+    public:
+        Site() {
+            // Make a directory to hold the files.
+            char name[] = "/tmp/http_bench.XXXXXX";
+            if (!mkdtemp(name)) {
+                throw std::runtime_error("Failed to make temp directory");
+            }
+            directory = name;
+            page = directory + "/page.html";
+            structure = directory + "/structure.struct";
+
+            // A 4 KiB page.
+            std::ofstream(page) << "<!DOCTYPE html><html><head><title>Bench</title></head><body>" << std::string(4000, 'x') << "</body></html>";
+
+            // The root, 20000 pages under it and a chain of paths 10 deep.
+            std::ofstream file(structure);
+            file << "web " << HOST << " url " << HOST << " path " << page << "\n";
+            for (int i = 0; i < 20000; i++) {
+                file << "pge " << HOST << " url /page" << i << " path " << page << "\n";
+            }
+            file << "pge " << HOST << " url /about path " << page << "\n";
+            std::string parent = HOST;
+            for (char c = 'a'; c <= 'i'; c++) {
+                file << "pth " << parent << " url /" << c << " path " << page << "\n";
+                parent = std::string("/") + c;
+            }
+            file << "pge " << parent << " url /page path " << page << "\n";
+        }
+
+        ~Site() {
+            unlink(page.c_str());
+            unlink(structure.c_str());
+            rmdir(directory.c_str());
+        }
+};
+
+int main(int argc, char* argv[]) {
+    // Read the options.
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--time" && i + 1 < argc) {
+            options.target_ms = atof(argv[++i]);
+        } else if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: " << argv[0] << " [--time ms] [filter]" << std::endl;
+            return 0;
+        } else {
+            options.filter = arg;
+        }
+    }
+
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(12) << "iterations" << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op" << std::setw(12) << "bytes/op" << std::endl;
+
+    // The request corpus.
+    std::vector<std::pair<std::string, std::string>> corpus = {
+        {"small", small_get()},
+        {"browser", browser_get()},
+        {"cookie", cookie_get()},
+        {"many_headers", many_headers_get()},
+        {"deep", deep_get()}
+    };
+
+    // Parsing into an owning request, and in place into a view.
+    for (const std::pair<std::string, std::string>& entry : corpus) {
+        const std::string& raw = entry.second;
+        run(options, "parse/request/" + entry.first, [&raw]() {
+            HTTP::Requests::HTTPRequest request(raw);
+            keep(request);
+        });
+    }
+    for (const std::pair<std::string, std::string>& entry : corpus) {
+        const std::string& raw = entry.second;
+        run(options, "parse/view/" + entry.first, [&raw]() {
+            HTTP::Requests::RequestView view;
+            size_t length = HTTP::Requests::ParseRequest(raw, view);
+            keep(length);
+            keep(view);
+        });
+    }
+
+    // Serializing responses.
+    std::string body(1024, 'x');
+    run(options, "serialize/toString/small", [&body]() {
+        HTTP::Responses::HTTPResponse response(200, std::map<std::string, std::string>(), body);
+        std::string raw = response.toString();
+        keep(raw);
+    });
+    std::map<std::string, std::string> headers;
+    for (int i = 0; i < 12; i++) {
+        headers["X-Header-" + std::to_string(i)] = "value-" + std::to_string(i);
+    }
+    run(options, "serialize/toString/headers", [&body, &headers]() {
+        HTTP::Responses::HTTPResponse response(200, headers, body);
+        std::string raw = response.toString();
+        keep(raw);
+    });
+    std::shared_ptr<const std::string> fixed = std::make_shared<const std::string>("Content-Type: text/html\r\n");
+    run(options, "serialize/get_head/route", [&fixed]() {
+        HTTP::Responses::HTTPResponse response(200, std::map<std::string, std::string>(), "");
+        response.fixed_headers = fixed;
+        std::string head = response.get_head();
+        keep(head);
+    });
+
+    // Routing and building responses over a site on disk.
+    Site site;
+    HTTP::Responses::ResponseBuilder builder(site.structure);
+    std::vector<std::pair<std::string, HTTP::Requests::HTTPRequest>> requests = {
+        {"root", HTTP::Requests::HTTPRequest(small_get())},
+        {"page", HTTP::Requests::HTTPRequest(browser_get())},
+        {"deep", HTTP::Requests::HTTPRequest(deep_get())},
+        {"wide", HTTP::Requests::HTTPRequest("GET /page19999 HTTP/1.1\r\nHost: " + HOST + "\r\n\r\n")},
+        {"missing", HTTP::Requests::HTTPRequest("GET / HTTP/1.1\r\nHost: example.com\r\n\r\n")}
+    };
+    for (std::pair<std::string, HTTP::Requests::HTTPRequest>& entry : requests) {
+        HTTP::Requests::HTTPRequest& request = entry.second;
+        run(options, "build/" + entry.first, [&builder, &request]() {
+            HTTP::Responses::HTTPResponse response = builder.build(request);
+            keep(response);
+        });
+    }
+    HTTP::Responses::ResponseBuilder cached_builder(builder);
+    cached_builder.cache = std::make_shared<Cache::ContentCache>(1 << 20);
+    for (std::pair<std::string, HTTP::Requests::HTTPRequest>& entry : requests) {
+        HTTP::Requests::HTTPRequest& request = entry.second;
+        run(options, "build/cached/" + entry.first, [&cached_builder, &request]() {
+            HTTP::Responses::HTTPResponse response = cached_builder.build(request);
+            keep(response);
+        });
+    }
+    // Revalidating a cached page the client already holds.
+    std::shared_ptr<const Cache::Entry> page_entry = cached_builder.cache->Get(site.page);
+    HTTP::Requests::HTTPRequest revalidate("GET /about HTTP/1.1\r\nHost: " + HOST + "\r\nIf-None-Match: " + page_entry->etag + "\r\n\r\n");
+    run(options, "build/cached/not_modified", [&cached_builder, &revalidate]() {
+        HTTP::Responses::HTTPResponse response = cached_builder.build(revalidate);
+        keep(response);
+    });
+
+    // Negotiating an encoding for a cached page.
+    std::vector<std::pair<std::string, std::string>> accept_encodings = {
+        {"browser", "gzip, deflate, br, zstd"},
+        {"weighted", "br;q=1.0, gzip;q=0.8, deflate;q=0.6, identity;q=0.1, *;q=0"},
+        {"none", ""}
+    };
+    for (const std::pair<std::string, std::string>& entry : accept_encodings) {
+        const std::string& accept_encoding = entry.second;
+        run(options, "encoding/" + entry.first, [&accept_encoding, &page_entry]() {
+            Cache::Encoding encoding = HTTP::Responses::ChooseEncoding(accept_encoding, *page_entry);
+            keep(encoding);
+        });
+    }
+
+    for (std::pair<std::string, HTTP::Requests::HTTPRequest>& entry : requests) {
+        const std::string& url = entry.second.url;
+        run(options, "route/" + entry.first, [&builder, &url]() {
+            HTTP::Responses::Node* node = builder.route(url);
+            keep(node);
+        });
+    }
+
+    // Splitting urls on their own.
+    std::string deep_url = HOST + "/a/b/c/d/e/f/g/h/i/page";
+    run(options, "split_url/deep", [&deep_url]() {
+        std::pair<std::string, std::string> parts = HTTP::Responses::split_url(deep_url);
+        keep(parts);
+    });
+    std::string deep_route = "a/b/c/d/e/f/g/h/i/page";
+    run(options, "split_route/deep", [&deep_route]() {
+        std::vector<std::string> parts = HTTP::Responses::split_route(deep_route);
+        keep(parts);
+    });
+
+    return 0;
+}
@@ -8,12 +8,29 @@
 #include <memory>
 #include <algorithm>
 #include <map>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <string_view>
+#include <charconv>
+#include <ctime>
+#include <cstdio>
 #include <sstream>
 #include <thread>
 #include <mutex>
 #include <chrono>
-#include <sys/epoll.h>
+#include <atomic>
+#include <deque>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include "../sockets/sockets.hpp"
+#include "../io/io.hpp"
+#include "../timers/timers.hpp"
+#include "../scan/scan.hpp"
+#include "../cache/cache.hpp"
 
 /**
  * @namespace HTTP
@@ -29,6 +46,622 @@ namespace HTTP {
      * @date 6/10/25
      */
     namespace Requests {
+        /**
+         * @enum KnownHeader
+         * @brief Headers common enough to get a fixed slot, found with a perfect hash instead of comparing names.
+         * @author banana584
+         * @date 17/10/26
+         */
+        enum class KnownHeader : uint8_t {
+            Host,
+            Connection,
+            ContentLength,
+            ContentType,
+            TransferEncoding,
+            Accept,
+            AcceptEncoding,
+            AcceptLanguage,
+            UserAgent,
+            Cookie,
+            Authorization,
+            IfNoneMatch,
+            IfModifiedSince,
+            IfMatch,
+            IfUnmodifiedSince,
+            IfRange,
+            Range,
+            Expect,
+            Upgrade,
+            Origin,
+            Referer,
+            CacheControl,
+            Pragma,
+            TE,
+            KeepAlive,
+            ContentEncoding,
+            Date,
+            XForwardedFor,
+            Count ///< The number of known headers, not a header.
+        };
+
+        constexpr size_t KNOWN_HEADER_COUNT = static_cast<size_t>(KnownHeader::Count); ///< The number of known headers.
+        static_assert(KNOWN_HEADER_COUNT < 64, "Known headers are tracked in 64 bit masks");
+
+        /**
+         * @brief The name of each known header, in the order of KnownHeader.
+         */
+        constexpr std::array<std::string_view, KNOWN_HEADER_COUNT> KNOWN_HEADER_NAMES = {{
+            "Host", "Connection", "Content-Length", "Content-Type", "Transfer-Encoding", "Accept", "Accept-Encoding", "Accept-Language",
+            "User-Agent", "Cookie", "Authorization", "If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since", "If-Range",
+            "Range", "Expect", "Upgrade", "Origin", "Referer", "Cache-Control", "Pragma", "TE",
+            "Keep-Alive", "Content-Encoding", "Date", "X-Forwarded-For"
+        }};
+
+        constexpr size_t HEADER_TABLE_SIZE = 64; ///< The number of slots in the perfect hash table, a power of 2.
+
+        /**
+         * @brief Lower-cases an ASCII letter, leaving anything else alone.
+         * @param c The character.
+         * @return The lower-case character.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr char ToLower(char c) {
+            return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+        }
+
+        /**
+         * @brief Compares two header names, ignoring case.
+         * @param a The first name.
+         * @param b The second name.
+         * @return True if they are the same name.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+            if (a.size() != b.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); i++) {
+                if (ToLower(a[i]) != ToLower(b[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * @brief Hashes a header name from its length and its first, middle and last characters, ignoring case.
+         * @param name The name, which must not be empty.
+         * @param seed The seed that makes the hash perfect over the known headers.
+         * @return The slot in the table.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr uint32_t HashHeaderName(std::string_view name, uint32_t seed) {
+            uint32_t length = static_cast<uint32_t>(name.size());
+            uint32_t x = (length * seed) ^ (static_cast<uint32_t>(static_cast<uint8_t>(name[0]) | 0x20) << 2) ^ ((static_cast<uint32_t>(static_cast<uint8_t>(name[length - 1]) | 0x20) * seed) >> 3) ^ (static_cast<uint32_t>(static_cast<uint8_t>(name[length / 2]) | 0x20) * 7);
+            return ((x * 2654435761u) >> 16) & (HEADER_TABLE_SIZE - 1);
+        }
+
+        /**
+         * @brief Finds the first seed that gives every known header its own slot, run at compile time.
+         * @return The seed, or 0 if none was found.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr uint32_t FindHeaderSeed() {
+            for (uint32_t seed = 1; seed < 4096; seed++) {
+                std::array<bool, HEADER_TABLE_SIZE> used = {};
+                bool perfect = true;
+                for (size_t i = 0; i < KNOWN_HEADER_COUNT && perfect; i++) {
+                    uint32_t slot = HashHeaderName(KNOWN_HEADER_NAMES[i], seed);
+                    perfect = !used[slot];
+                    used[slot] = true;
+                }
+                if (perfect) {
+                    return seed;
+                }
+            }
+            return 0;
+        }
+
+        constexpr uint32_t HEADER_SEED = FindHeaderSeed(); ///< The seed that makes HashHeaderName perfect over the known headers.
+        static_assert(HEADER_SEED != 0, "No perfect hash seed for the known headers, grow HEADER_TABLE_SIZE");
+
+        /**
+         * @brief Builds the table from slot to known header, run at compile time.
+         * @return The table, with KNOWN_HEADER_COUNT in empty slots.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr std::array<uint8_t, HEADER_TABLE_SIZE> BuildHeaderTable() {
+            std::array<uint8_t, HEADER_TABLE_SIZE> table = {};
+            for (size_t i = 0; i < HEADER_TABLE_SIZE; i++) {
+                table[i] = static_cast<uint8_t>(KNOWN_HEADER_COUNT);
+            }
+            for (size_t i = 0; i < KNOWN_HEADER_COUNT; i++) {
+                table[HashHeaderName(KNOWN_HEADER_NAMES[i], HEADER_SEED)] = static_cast<uint8_t>(i);
+            }
+            return table;
+        }
+
+        constexpr std::array<uint8_t, HEADER_TABLE_SIZE> HEADER_TABLE = BuildHeaderTable(); ///< The known header in each slot.
+
+        /**
+         * @brief Finds which known header a name is.
+         * @param name The name of the header, in any case.
+         * @return The header, or KnownHeader::Count if it isn't a known one.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr KnownHeader FindKnownHeader(std::string_view name) {
+            if (name.empty()) {
+                return KnownHeader::Count;
+            }
+            uint8_t index = HEADER_TABLE[HashHeaderName(name, HEADER_SEED)];
+            return (index != KNOWN_HEADER_COUNT && EqualsIgnoreCase(KNOWN_HEADER_NAMES[index], name)) ? static_cast<KnownHeader>(index) : KnownHeader::Count;
+        }
+
+        static_assert(FindKnownHeader("content-length") == KnownHeader::ContentLength, "Known headers must be found ignoring case");
+        static_assert(FindKnownHeader("X-Unknown") == KnownHeader::Count, "Unknown headers must not be found");
+
+        /**
+         * @struct HeaderView
+         * @brief A header of a request pointing into the buffer it was parsed from.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct HeaderView {
+            std::string_view name; ///< The name of the header as sent.
+            std::string_view value; ///< The value with surrounding whitespace removed.
+        };
+
+        /**
+         * @class RequestView
+         * @brief The request line and headers of a request, pointing into the buffer they were parsed from so parsing doesn't allocate.
+         * @warning Only valid while the parsed buffer is unchanged.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class RequestView {
+            public:
+                static constexpr size_t MAX_HEADERS = 64; ///< The most headers a request can have.
+
+                std::string_view method; ///< The method of the request.
+                std::string_view target; ///< The target of the request as sent, e.g /index.html.
+                std::string_view path; ///< The target's path once normalized by NormalizeTarget, null until then.
+                std::string_view query; ///< The target's query string without the ?, as sent, empty if there isn't one.
+                std::string_view version; ///< The version of the request, e.g HTTP/1.1.
+                std::array<HeaderView, KNOWN_HEADER_COUNT> known; ///< The first of each known header in its fixed slot, with a null value if it wasn't sent.
+                std::array<HeaderView, MAX_HEADERS> headers; ///< Headers that aren't known, and repeats of ones that are, in the order they were sent.
+                size_t header_count = 0; ///< The number of headers used.
+                size_t header_length = 0; ///< The length of the request line and headers, including the blank line.
+            public:
+                /**
+                 * @brief Finds a header by name, ignoring case.
+                 * @param name The name of the header.
+                 * @return The value of the first header with the name, or an empty view with a null data pointer if there isn't one.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string_view find_header(std::string_view name) const;
+
+                /**
+                 * @brief Returns a known header straight from its slot.
+                 * @param header The header.
+                 * @return The value of the first header sent, or an empty view with a null data pointer if there isn't one.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string_view get_header(KnownHeader header) const { return known[static_cast<size_t>(header)].value; }
+        };
+
+        /**
+         * @brief Parses the request line and headers of a request without copying them.
+         * @param raw The buffer the request starts at.
+         * @param request Filled with views into raw.
+         * @return The length of the request line and headers including the blank line, or 0 if raw doesn't hold all of them yet.
+         * @warning Throws std::invalid_argument if the request line is malformed or there are more than RequestView::MAX_HEADERS headers.
+         * @author banana584
+         * @date 17/10/26
+         */
+        size_t ParseRequest(std::string_view raw, RequestView& request);
+
+        /**
+         * @brief Normalizes a request target into a canonical path in one pass: percent-escapes are decoded, repeated slashes collapsed, . and .. segments resolved and the query and fragment split off.
+         * @param target The target as sent, in origin-form, absolute-form or *.
+         * @param out Where the path is written, with room for target.size() bytes, it can be target's own bytes since the path never outgrows what it was read from.
+         * @param query Set to the query string without the ?, pointing into target, or empty if there isn't one.
+         * @return The path in out, which starts with / and has no trailing / unless it is the root.
+         * @warning Throws std::invalid_argument for bad escapes, escapes that decode to a /, backslash or control character, and .. segments that climb above the root.
+         * @author banana584
+         * @date 17/10/26
+         */
+        std::string_view NormalizeTarget(std::string_view target, char* out, std::string_view& query);
+
+        /**
+         * @brief Normalizes the target of a parsed request over itself, so the path needs no memory of its own.
+         * @param buffer The writable start of the buffer request was parsed from.
+         * @param request The parsed request, whose path and query are set.
+         * @warning Throws std::invalid_argument if the target can't be normalized, see NormalizeTarget.
+         * @author banana584
+         * @date 17/10/26
+         */
+        void NormalizeTarget(char* buffer, RequestView& request);
+
+        /**
+         * @class RequestParser
+         * @brief Parses the request line and headers of a request as they arrive, carrying on from where the last call stopped so no byte is scanned twice.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class RequestParser {
+            private:
+                /**
+                 * @enum Stage
+                 * @brief The part of the request the parser is in.
+                 */
+                enum class Stage {
+                    Method, ///< Reading the method.
+                    Target, ///< Reading the target.
+                    Version, ///< Reading the version.
+                    LineEnd, ///< At the end of the request line or a header line.
+                    HeaderStart, ///< At the start of a header line or the blank line.
+                    HeaderName, ///< Reading a header name.
+                    HeaderValue, ///< Reading a header value.
+                    BlankLine, ///< At the blank line that ends the headers.
+                    Done ///< Every header has been parsed.
+                };
+
+                /**
+                 * @struct Span
+                 * @brief Where part of the request is, as offsets so the buffer can move between reads.
+                 */
+                struct Span {
+                    size_t start; ///< The offset from the start of the request.
+                    size_t length; ///< The number of bytes.
+                };
+
+                Stage stage; ///< The part of the request the parser is in.
+                size_t position; ///< The offset of the next byte to look at.
+                size_t mark; ///< Where the part being read started.
+                Span method; ///< The method once read.
+                Span target; ///< The target once read.
+                Span version; ///< The version once read.
+                /**
+                 * @struct Field
+                 * @brief A header read so far.
+                 */
+                struct Field {
+                    Span name; ///< Where the name is.
+                    Span value; ///< Where the value is.
+                    KnownHeader header; ///< Which known header it is, or KnownHeader::Count.
+                };
+
+                std::array<Field, RequestView::MAX_HEADERS> headers; ///< Each header read.
+                size_t header_count; ///< The number of headers read.
+                uint64_t seen; ///< A bit for each known header read, to catch repeats that aren't allowed.
+            private:
+                /**
+                 * @brief Steps over a CRLF or bare LF.
+                 * @param raw The buffer the request starts at.
+                 * @return False if the line end hasn't fully arrived.
+                 * @warning Throws std::invalid_argument if position isn't at a line end.
+                 */
+                bool SkipLineEnd(std::string_view raw);
+            public:
+                /**
+                 * @brief Constructor.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                RequestParser();
+
+                /**
+                 * @brief Forgets everything parsed so the next request can be parsed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Reset();
+
+                /**
+                 * @brief Parses whatever has arrived since the last call.
+                 * @param raw The buffer the request starts at, holding at least everything the last call saw.
+                 * @param request Filled with views into raw once every header has arrived.
+                 * @return The length of the request line and headers including the blank line, or 0 if more data is needed.
+                 * @warning Throws std::invalid_argument if the request is malformed, has more than RequestView::MAX_HEADERS headers, or repeats Host, Content-Length or Transfer-Encoding. Calling again once done just refills request, e.g after the buffer moved.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t Parse(std::string_view raw, RequestView& request);
+        };
+
+        /**
+         * @class BodyDecoder
+         * @brief Takes the framing off a request body as it arrives, for either a Content-Length or chunked transfer-encoding.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class BodyDecoder {
+            private:
+                /**
+                 * @enum Stage
+                 * @brief The part of the body the decoder is in.
+                 */
+                enum class Stage {
+                    Data, ///< Reading body bytes.
+                    ChunkSize, ///< Reading the hex size of a chunk.
+                    ChunkExtension, ///< Skipping extensions after a chunk size.
+                    ChunkSizeEnd, ///< At the LF after a chunk size line's CR.
+                    ChunkDataEnd, ///< At the line end after a chunk's data.
+                    ChunkDataEndLF, ///< At the LF after a chunk's data and CR.
+                    Trailer, ///< Reading trailer lines after the last chunk.
+                    Done ///< The whole body has been read.
+                };
+
+                static constexpr size_t MAX_TRAILER_SIZE = 8192; ///< The most bytes of trailers allowed after the last chunk.
+
+                bool chunked; ///< If the body is chunked rather than a fixed length.
+                Stage stage; ///< The part of the body the decoder is in.
+                size_t remaining; ///< The bytes left in the body or current chunk.
+                size_t decoded; ///< The bytes of body given out so far.
+                bool size_digits; ///< If the current chunk size line has any digits yet.
+                size_t trailer_size; ///< The bytes of trailers read so far.
+                size_t line_length; ///< The length of the current trailer line.
+            public:
+                /**
+                 * @brief Constructor for an empty body.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                BodyDecoder();
+
+                /**
+                 * @brief Starts decoding a body of a fixed length.
+                 * @param content_length The length from the Content-Length header.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Reset(size_t content_length);
+
+                /**
+                 * @brief Starts decoding a chunked body.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void ResetChunked();
+
+                /**
+                 * @brief Decodes as much of the body as possible, stopping after each run of body bytes.
+                 * @param input The bytes after whatever was consumed by the last call.
+                 * @param chunk Set to the body bytes found, a view into input that may be empty.
+                 * @return The bytes of input consumed, including framing, 0 if more data is needed.
+                 * @warning Throws std::invalid_argument if the chunked framing is malformed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t Decode(std::string_view input, std::string_view& chunk);
+
+                /**
+                 * @brief Returns if the whole body has been decoded.
+                 * @return True if done.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool done() const { return stage == Stage::Done; }
+
+                /**
+                 * @brief Returns if the body is chunked.
+                 * @return True if chunked.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool is_chunked() const { return chunked; }
+
+                /**
+                 * @brief Returns the bytes left in the body, or in the current chunk if chunked.
+                 * @return The number of bytes.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t get_remaining() const { return remaining; }
+
+                /**
+                 * @brief Returns the bytes of body decoded so far.
+                 * @return The number of bytes.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t get_decoded() const { return decoded; }
+        };
+
+        /**
+         * @brief Sets up a decoder for the body a request's headers describe.
+         * @param request The parsed request.
+         * @param decoder The decoder to set up.
+         * @return False if the request uses a transfer-encoding other than chunked.
+         * @warning Throws std::invalid_argument if Content-Length is invalid or is sent along with Transfer-Encoding.
+         * @author banana584
+         * @date 17/10/26
+         */
+        bool StartBody(const RequestView& request, BodyDecoder& decoder);
+
+        /**
+         * @class RequestBody
+         * @brief A request body built up chunk by chunk, kept in memory until it passes a threshold and then moved into an unlinked temp file.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class RequestBody {
+            public:
+                std::string memory; ///< The body while it is under the spill threshold.
+                int fd; ///< The temp file the body spilled into, or -1 if it is in memory.
+                size_t length; ///< The size of the body in bytes.
+                size_t spill_threshold; ///< The size above which the body goes to a temp file.
+                std::string temp_directory; ///< The directory temp files are made in.
+            public:
+                /**
+                 * @brief Constructor for an empty body.
+                 * @param spill_threshold The size above which the body goes to a temp file.
+                 * @param temp_directory The directory temp files are made in.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                RequestBody(size_t spill_threshold = SIZE_MAX, std::string temp_directory = "/tmp");
+
+                /**
+                 * @brief Copying is disabled since the fd is owned.
+                 */
+                RequestBody(const RequestBody& other) = delete;
+
+                /**
+                 * @brief Copying is disabled since the fd is owned.
+                 */
+                RequestBody& operator=(const RequestBody& other) = delete;
+
+                /**
+                 * @brief Destructor that closes the temp file, which was unlinked when made.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ~RequestBody();
+
+                /**
+                 * @brief Adds a chunk to the end of the body, spilling to a temp file if it gets too big.
+                 * @param chunk The bytes to add.
+                 * @warning Throws std::runtime_error if the temp file can't be made or written.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Append(std::string_view chunk);
+
+                /**
+                 * @brief Returns if the body has moved to a temp file.
+                 * @return True if spilled.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool spilled() const { return fd >= 0; }
+
+                /**
+                 * @brief Reads part of the body, so it can be handled a chunk at a time.
+                 * @param offset Where in the body to start.
+                 * @param buffer Where to copy the bytes to.
+                 * @param size The most bytes to copy.
+                 * @return The bytes copied, 0 at the end of the body.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t Read(size_t offset, char* buffer, size_t size);
+
+                /**
+                 * @brief Reads the whole body into memory.
+                 * @return The body.
+                 * @warning Copies the whole body, large bodies should be read a chunk at a time.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string read_all();
+        };
+
+        /**
+         * @class HeaderMap
+         * @brief The headers of a request, with known headers in fixed slots and only the rest in a list.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class HeaderMap {
+            private:
+                std::array<std::string, KNOWN_HEADER_COUNT> known; ///< The value of each known header.
+                uint64_t present; ///< A bit for each known header that is set.
+                std::vector<std::pair<std::string, std::string>> overflow; ///< Headers that aren't known, and repeats of ones that are, in the order they were added.
+            public:
+                /**
+                 * @brief Constructor for no headers.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HeaderMap();
+
+                /**
+                 * @brief Constructor that copies headers from a map.
+                 * @param headers The headers.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HeaderMap(const std::map<std::string, std::string>& headers);
+
+                /**
+                 * @brief Finds a header by name, ignoring case.
+                 * @param name The name of the header.
+                 * @return A pointer to the value of the first header with the name, or null if there isn't one.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                const std::string* find(std::string_view name) const;
+
+                /**
+                 * @brief Returns a known header straight from its slot.
+                 * @param header The header.
+                 * @return A pointer to its value, or null if it isn't set.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                const std::string* get(KnownHeader header) const { return (present >> static_cast<size_t>(header)) & 1 ? &known[static_cast<size_t>(header)] : nullptr; }
+
+                /**
+                 * @brief Adds a header, keeping any already set with the same name.
+                 * @param name The name of the header.
+                 * @param value The value of the header.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Add(std::string_view name, std::string_view value);
+
+                /**
+                 * @brief Sets a header, replacing every header already set with the same name.
+                 * @param name The name of the header.
+                 * @param value The value of the header.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Set(std::string_view name, std::string_view value);
+
+                /**
+                 * @brief Removes every header with a name.
+                 * @param name The name of the header.
+                 * @return True if any were removed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool Remove(std::string_view name);
+
+                /**
+                 * @brief Returns the number of headers.
+                 * @return The number of headers.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t size() const;
+
+                /**
+                 * @brief Returns if there are no headers.
+                 * @return True if empty.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool empty() const { return present == 0 && overflow.empty(); }
+
+                /**
+                 * @brief Lists every header, known ones first with their usual names.
+                 * @return The name and value of each header, valid until the map is changed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::vector<std::pair<std::string_view, std::string_view>> list() const;
+        };
+
         /**
          * @class HTTPRequest
          * @brief A representation of a HTTP request.
@@ -38,9 +671,11 @@ namespace HTTP {
         class HTTPRequest {
             public:
                 std::string method; ///< The method of the request - GET, POST, HEAD, etc.
-                std::string url; ///< The url of the request.
-                std::map<std::string, std::string> headers; ///< The headers in the request.
+                std::string url; ///< The url of the request, the host followed by the normalized path.
+                std::string query; ///< The query string of the request without the ?, empty if there isn't one.
+                HeaderMap headers; ///< The headers in the request.
                 std::string body; ///< The body of the request, can be empty to represent no body.
+                std::shared_ptr<RequestBody> body_file; ///< The body instead if it was too big to keep in memory, null otherwise.
             public:
                 /**
                  * @brief Constructor that takes in parts seperately.
@@ -61,6 +696,15 @@ namespace HTTP {
                  */
                 HTTPRequest(std::string raw);
 
+                /**
+                 * @brief Constructor that copies a parsed request.
+                 * @param view The parsed request line and headers.
+                 * @param body The body of the request.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HTTPRequest(const RequestView& view, std::string_view body);
+
                 /**
                  * @brief Destructor to cleanup resources.
                  * @author banana584
@@ -93,14 +737,124 @@ namespace HTTP {
          */
         enum class Status {
             OK = 200,
+            NotModified = 304,
             BadRequest = 400,
             Unauthorized = 401,
             Forbidden = 403,
             NotFound = 404,
+            PreconditionFailed = 412,
+            PayloadTooLarge = 413,
+            RequestHeaderFieldsTooLarge = 431,
             InternalServerError = 500,
+            NotImplemented = 501,
             BadGateway = 502
         };
 
+        /**
+         * @struct StatusInfo
+         * @brief A status code with its reason and whole status line written out, so neither is formatted per response.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct StatusInfo {
+            int code; ///< The status code.
+            std::string_view reason; ///< The reason phrase, e.g "Not Found".
+            std::string_view line; ///< The status line including its CRLF, e.g "HTTP/1.1 404 Not Found\r\n".
+        };
+
+        /**
+         * @brief Every status code with a known reason, in order of code.
+         */
+        constexpr StatusInfo STATUS_INFO[] = {
+            {100, "Continue", "HTTP/1.1 100 Continue\r\n"},
+            {101, "Switching Protocols", "HTTP/1.1 101 Switching Protocols\r\n"},
+            {200, "OK", "HTTP/1.1 200 OK\r\n"},
+            {201, "Created", "HTTP/1.1 201 Created\r\n"},
+            {202, "Accepted", "HTTP/1.1 202 Accepted\r\n"},
+            {204, "No Content", "HTTP/1.1 204 No Content\r\n"},
+            {206, "Partial Content", "HTTP/1.1 206 Partial Content\r\n"},
+            {301, "Moved Permanently", "HTTP/1.1 301 Moved Permanently\r\n"},
+            {302, "Found", "HTTP/1.1 302 Found\r\n"},
+            {303, "See Other", "HTTP/1.1 303 See Other\r\n"},
+            {304, "Not Modified", "HTTP/1.1 304 Not Modified\r\n"},
+            {307, "Temporary Redirect", "HTTP/1.1 307 Temporary Redirect\r\n"},
+            {308, "Permanent Redirect", "HTTP/1.1 308 Permanent Redirect\r\n"},
+            {400, "Bad Request", "HTTP/1.1 400 Bad Request\r\n"},
+            {401, "Unauthorized", "HTTP/1.1 401 Unauthorized\r\n"},
+            {403, "Forbidden", "HTTP/1.1 403 Forbidden\r\n"},
+            {404, "Not Found", "HTTP/1.1 404 Not Found\r\n"},
+            {405, "Method Not Allowed", "HTTP/1.1 405 Method Not Allowed\r\n"},
+            {408, "Request Timeout", "HTTP/1.1 408 Request Timeout\r\n"},
+            {411, "Length Required", "HTTP/1.1 411 Length Required\r\n"},
+            {412, "Precondition Failed", "HTTP/1.1 412 Precondition Failed\r\n"},
+            {413, "Payload Too Large", "HTTP/1.1 413 Payload Too Large\r\n"},
+            {414, "URI Too Long", "HTTP/1.1 414 URI Too Long\r\n"},
+            {416, "Range Not Satisfiable", "HTTP/1.1 416 Range Not Satisfiable\r\n"},
+            {417, "Expectation Failed", "HTTP/1.1 417 Expectation Failed\r\n"},
+            {429, "Too Many Requests", "HTTP/1.1 429 Too Many Requests\r\n"},
+            {431, "Request Header Fields Too Large", "HTTP/1.1 431 Request Header Fields Too Large\r\n"},
+            {500, "Internal Server Error", "HTTP/1.1 500 Internal Server Error\r\n"},
+            {501, "Not Implemented", "HTTP/1.1 501 Not Implemented\r\n"},
+            {502, "Bad Gateway", "HTTP/1.1 502 Bad Gateway\r\n"},
+            {503, "Service Unavailable", "HTTP/1.1 503 Service Unavailable\r\n"},
+            {504, "Gateway Timeout", "HTTP/1.1 504 Gateway Timeout\r\n"},
+            {505, "HTTP Version Not Supported", "HTTP/1.1 505 HTTP Version Not Supported\r\n"}
+        };
+
+        constexpr size_t STATUS_INFO_COUNT = sizeof(STATUS_INFO) / sizeof(STATUS_INFO[0]); ///< The number of known statuses.
+
+        /**
+         * @brief Checks every status line is the code and reason it claims to be, run at compile time.
+         * @return True if every line matches.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr bool CheckStatusLines() {
+            for (size_t i = 0; i < STATUS_INFO_COUNT; i++) {
+                const StatusInfo& info = STATUS_INFO[i];
+                std::string_view line = info.line;
+                if (line.size() != 15 + info.reason.size() || line.substr(0, 9) != "HTTP/1.1 " || line[9] != '0' + info.code / 100 || line[10] != '0' + info.code / 10 % 10 || line[11] != '0' + info.code % 10 || line[12] != ' ' || line.substr(13, info.reason.size()) != info.reason || line.substr(line.size() - 2) != "\r\n") {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static_assert(CheckStatusLines(), "A status line doesn't match its code and reason");
+
+        /**
+         * @brief Builds the table from code to its index in STATUS_INFO, run at compile time.
+         * @return The table for codes 100 to 599, with STATUS_INFO_COUNT for unknown codes.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr std::array<uint8_t, 500> BuildStatusTable() {
+            std::array<uint8_t, 500> table = {};
+            for (size_t i = 0; i < table.size(); i++) {
+                table[i] = static_cast<uint8_t>(STATUS_INFO_COUNT);
+            }
+            for (size_t i = 0; i < STATUS_INFO_COUNT; i++) {
+                table[STATUS_INFO[i].code - 100] = static_cast<uint8_t>(i);
+            }
+            return table;
+        }
+
+        constexpr std::array<uint8_t, 500> STATUS_TABLE = BuildStatusTable(); ///< The index in STATUS_INFO of each code from 100.
+
+        /**
+         * @brief Finds the reason and status line of a code.
+         * @param code The status code.
+         * @return The status, or null if the code isn't known.
+         * @author banana584
+         * @date 17/10/26
+         */
+        constexpr const StatusInfo* FindStatus(int code) {
+            return (code >= 100 && code < 600 && STATUS_TABLE[code - 100] != STATUS_INFO_COUNT) ? &STATUS_INFO[STATUS_TABLE[code - 100]] : nullptr;
+        }
+
+        static_assert(FindStatus(404) != nullptr && FindStatus(404)->reason == "Not Found", "Known statuses must be found");
+        static_assert(FindStatus(299) == nullptr, "Unknown statuses must not be found");
+
         /**
          * @brief Converts a status into a string.
          * @param status A value from the Status enum.
@@ -110,6 +864,63 @@ namespace HTTP {
          */
         std::string get_status_string(Status status);
 
+        /**
+         * @brief Returns the current time formatted for the Date header, reformatted at most once a second.
+         * @return The date, e.g "Sat, 17 Oct 2026 09:30:00 GMT", valid until the next call on the same thread.
+         * @warning Each thread keeps its own copy so no locking is needed.
+         * @author banana584
+         * @date 17/10/26
+         */
+        std::string_view get_date();
+
+        /**
+         * @class FileBody
+         * @brief An open file used as a response body so it can be sent with sendfile instead of being read into memory.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class FileBody {
+            public:
+                int fd; ///< The file descriptor of the open file.
+                size_t length; ///< The size of the file in bytes.
+                std::string etag; ///< The strong entity tag of the file.
+                time_t modified; ///< When the file was last modified, to the second.
+            public:
+                /**
+                 * @brief Constructor that opens a file for reading.
+                 * @param path The path of the file to open.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                FileBody(const std::string& path);
+
+                /**
+                 * @brief Copying is disabled since the fd is owned.
+                 */
+                FileBody(const FileBody& other) = delete;
+
+                /**
+                 * @brief Copying is disabled since the fd is owned.
+                 */
+                FileBody& operator=(const FileBody& other) = delete;
+
+                /**
+                 * @brief Destructor that closes the file.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ~FileBody();
+
+                /**
+                 * @brief Reads the whole file into memory.
+                 * @return The contents of the file.
+                 * @warning Copies the file, only for places that can't send from the fd.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string read_all();
+        };
+
         /**
          * @class HTTPResponse
          * @brief This class represents a HTTP response.
@@ -121,6 +932,11 @@ namespace HTTP {
                 int status; ///< The status of the response.
                 std::map<std::string, std::string> headers; ///< The headers for the response.
                 std::string body; ///< The body for the response - could be a html page, json or more.
+                std::shared_ptr<FileBody> file; ///< A file to send as the body instead of body, or null.
+                std::shared_ptr<const Cache::Entry> cached; ///< A file held in memory to send as the body instead of body, or null, its header block is used as fixed_headers.
+                Cache::Encoding encoding = Cache::Encoding::Identity; ///< Which of cached's encodings is sent.
+                std::shared_ptr<const std::string> fixed_headers; ///< Header lines serialized once and shared by every response from a route, written before headers.
+                bool keep_alive = true; ///< If the connection stays open, written as the Connection header unless headers has one.
             public:
                 /**
                  * @brief Constructor that takes in all the parts of the response.
@@ -154,6 +970,118 @@ namespace HTTP {
                  * @date 6/10/25
                  */
                 std::string toString();
+
+                /**
+                 * @brief Creates the status line of the response.
+                 * @return The status line including its CRLF, e.g "HTTP/1.1 200 OK\r\n".
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string get_status_line();
+
+                /**
+                 * @brief Serializes the headers of the response.
+                 * @return Every header line followed by the blank line that ends the headers.
+                 * @warning Date, Content-Length and Connection are added unless headers already has them.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string get_header_block();
+
+                /**
+                 * @brief Serializes the status line and headers into one buffer.
+                 * @return The status line, every header line and the blank line, as get_status_line and get_header_block give them.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                std::string get_head();
+        };
+
+        /**
+         * @class ResponseParser
+         * @brief Parses a response as it arrives, reading the body by Content-Length, chunked encoding or until the connection closes.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class ResponseParser {
+            private:
+                /**
+                 * @enum Stage
+                 * @brief The part of the response the parser is in.
+                 */
+                enum class Stage {
+                    Head, ///< Waiting for the blank line after the status line and headers.
+                    Body, ///< Reading a body framed by Content-Length or chunked encoding.
+                    UntilClose, ///< Reading a body that ends when the connection closes.
+                    Done ///< The whole response has been read.
+                };
+
+                Stage stage; ///< The part of the response the parser is in.
+                size_t scanned; ///< How much of the input has been searched for the end of the head.
+                bool no_body; ///< If the response can't have a body, e.g because it answers a HEAD request.
+                bool persistent; ///< If the connection can be used again after the response.
+                Requests::BodyDecoder decoder; ///< Takes the framing off the body.
+            public:
+                static constexpr size_t MAX_HEAD_SIZE = 65536; ///< The largest status line and header block accepted.
+            private:
+                /**
+                 * @brief Parses the status line and headers and works out how the body is framed.
+                 * @param head The head, up to and including the blank line.
+                 * @param response The response to fill in.
+                 */
+                void ParseHead(std::string_view head, HTTPResponse& response);
+            public:
+                /**
+                 * @brief Constructor.
+                 * @param no_body If the response can't have a body, e.g because it answers a HEAD request.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ResponseParser(bool no_body = false);
+
+                /**
+                 * @brief Starts again for the next response.
+                 * @param no_body If the response can't have a body, e.g because it answers a HEAD request.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Reset(bool no_body = false);
+
+                /**
+                 * @brief Parses as much of a response as has arrived.
+                 * @param input Every byte received that hasn't been consumed yet.
+                 * @param response The response to fill in, the head is only set once all of it has arrived.
+                 * @return The number of bytes consumed, which the caller drops before parsing again.
+                 * @throws std::invalid_argument If the response is malformed.
+                 * @warning Interim 1xx responses are skipped. Bytes after the response are left unconsumed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t Parse(std::string_view input, HTTPResponse& response);
+
+                /**
+                 * @brief Tells the parser the connection closed, which ends a body read until close.
+                 * @throws std::invalid_argument If the response isn't complete.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Finish();
+
+                /**
+                 * @brief Returns if the whole response has been read.
+                 * @return True if done.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool done() const { return stage == Stage::Done; }
+
+                /**
+                 * @brief Returns if the connection can be used for another request once the response is read.
+                 * @return True if the response was framed and the upstream didn't ask to close.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                bool keep_alive() const { return persistent; }
         };
 
         /**
@@ -182,6 +1110,8 @@ namespace HTTP {
                 NodeType type; ///< The type of the node.
                 std::string url_part; ///< The section of url this node owns.
                 std::string file_path; ///< The path to the data needed for creating responses - could be a html file, an API script, etc.
+                size_t max_body_size = 0; ///< The largest request body this route accepts, 0 to use the server's limit.
+                std::shared_ptr<const std::string> header_block; ///< The headers every response from the route starts with, serialized the first time it is used.
             public:
                 /**
                  * @brief Constructor for Node.
@@ -206,35 +1136,145 @@ namespace HTTP {
                 Node(std::shared_ptr<Node> parent, NodeType type, std::string url_part, std::string file_path);
 
                 /**
-                 * @brief Copy constructor for Node.
-                 * @param other A const reference to another node to copy all data into this.
+                 * @brief Copy constructor for Node.
+                 * @param other A const reference to another node to copy all data into this.
+                 * @author banana584
+                 * @date 6/10/25
+                 */
+                Node(const Node& other);
+
+                /**
+                 * @brief Default constructor for Node.
+                 * @author banana584
+                 * @date 6/10/25
+                 */
+                Node();
+
+                /**
+                 * @brief Copy operator overwrite.
+                 * @param other A const reference to another node to copy all data into new node.
+                 * @return A newly created Node reference.
+                 * @author banana584
+                 * @date 6/10/25
+                 */
+                Node& operator=(const Node& other);
+
+                /**
+                 * @brief Destructor to clean up resources.
+                 * @author banana584
+                 * @date 6/10/25
+                 */
+                ~Node();
+        };
+
+        /**
+         * @brief Splits a request's url into its host and route.
+         * @param url The url, which is the Host header followed by the target, e.g "127.0.0.1:8080/a/b".
+         * @return The host and the route without its leading or trailing /, or "/" if there is no route.
+         * @author banana584
+         * @date 17/10/26
+         */
+        std::pair<std::string, std::string> split_url(std::string_view url);
+
+        /**
+         * @brief Splits a route into the parts between each /.
+         * @param route The route, as split_url gives it.
+         * @return Each part in order.
+         * @author banana584
+         * @date 17/10/26
+         */
+        std::vector<std::string> split_route(std::string_view route);
+
+        /**
+         * @brief Chooses how to encode a cached file from a request's Accept-Encoding quality values.
+         * @param accept_encoding The value of the Accept-Encoding header, empty if there wasn't one.
+         * @param entry The file, only encodings it has are chosen.
+         * @return The acceptable encoding with the highest quality, preferring gzip then deflate on a tie, or identity if nothing else is acceptable.
+         * @warning Identity is chosen even when the client refused it, rather than answering 406.
+         * @author banana584
+         * @date 17/10/26
+         */
+        Cache::Encoding ChooseEncoding(std::string_view accept_encoding, const Cache::Entry& entry);
+
+        /**
+         * @brief Evaluates a request's If-Match, If-Unmodified-Since, If-None-Match and If-Modified-Since headers against a file, in the order RFC 9110 gives them.
+         * @param request The request.
+         * @param etag The strong entity tag of the representation that would be sent.
+         * @param modified When the file was last modified.
+         * @return OK to send the file, NotModified if the client's copy is current, or PreconditionFailed.
+         * @warning Dates that can't be parsed are ignored as the RFC asks.
+         * @author banana584
+         * @date 17/10/26
+         */
+        Status CheckConditions(const Requests::HTTPRequest& request, std::string_view etag, time_t modified);
+
+        /**
+         * @class Router
+         * @brief The routes of a Node tree compiled into an immutable compressed radix trie over normalized paths, kept in contiguous arrays so a lookup is one pass over the path whatever the fan-out.
+         * @warning Points at the nodes it was compiled from, so the tree must outlive it.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class Router {
+            private:
+                /**
+                 * @struct TrieNode
+                 * @brief A node of the trie, whose children sit next to each other sorted by the first byte of their label.
+                 */
+                struct TrieNode {
+                    uint32_t label_start; ///< Where the node's label starts in labels.
+                    uint32_t label_length; ///< The length of the node's label.
+                    uint32_t first_child; ///< The index of the node's first child.
+                    uint32_t child_count; ///< The number of children.
+                    Node* route; ///< The route that ends at this node, null if none does.
+                };
+
+                std::vector<TrieNode> nodes; ///< Every node, the root first.
+                std::string first_bytes; ///< The first byte of each node's label, by index, so children are searched without touching the nodes.
+                std::string labels; ///< Every label end to end.
+                size_t route_count; ///< The number of routes.
+            private:
+                /**
+                 * @brief Fills in a node and its children from sorted paths.
+                 * @param index The index of the node, already allocated.
+                 * @param paths Every path and its route, sorted.
+                 * @param begin The first path the node covers.
+                 * @param end One past the last path the node covers, all of them share their first depth bytes.
+                 * @param depth The length of path the node and its ancestors match.
+                 */
+                void Compile(uint32_t index, const std::vector<std::pair<std::string, Node*>>& paths, size_t begin, size_t end, size_t depth);
+            public:
+                /**
+                 * @brief Default constructor, for a router with no routes.
                  * @author banana584
-                 * @date 6/10/25
+                 * @date 17/10/26
                  */
-                Node(const Node& other);
+                Router();
 
                 /**
-                 * @brief Default constructor for Node.
+                 * @brief Constructor that compiles a tree, each node's path is its ancestors' url parts followed by its own.
+                 * @param root The node for the site itself, which owns the path /.
                  * @author banana584
-                 * @date 6/10/25
+                 * @date 17/10/26
                  */
-                Node();
+                Router(Node& root);
 
                 /**
-                 * @brief Copy operator overwrite.
-                 * @param other A const reference to another node to copy all data into new node.
-                 * @return A newly created Node reference.
+                 * @brief Finds the route for a path.
+                 * @param path A normalized path, e.g /a/b.
+                 * @return The node whose path is exactly path, or null if there isn't one.
                  * @author banana584
-                 * @date 6/10/25
+                 * @date 17/10/26
                  */
-                Node& operator=(const Node& other);
+                Node* Find(std::string_view path) const;
 
                 /**
-                 * @brief Destructor to clean up resources.
+                 * @brief Returns the number of routes.
+                 * @return The number of routes.
                  * @author banana584
-                 * @date 6/10/25
+                 * @date 17/10/26
                  */
-                ~Node();
+                size_t size() const { return route_count; }
         };
 
         /**
@@ -250,6 +1290,8 @@ namespace HTTP {
                 std::ifstream file; ///< File dictating tree structure.
             public:
                 std::shared_ptr<Node> tree; ///< Shared pointer to head of tree parsed from file.
+                Router router; ///< The tree compiled for lookups.
+                std::shared_ptr<Cache::ContentCache> cache; ///< Static files kept in memory, or null to send them from disk.
             public:
                 /**
                  * @brief Default constructor.
@@ -283,6 +1325,15 @@ namespace HTTP {
                  */
                 HTTPResponse build(Requests::HTTPRequest& request);
 
+                /**
+                 * @brief Finds the node a url routes to.
+                 * @param url The url of a request, host followed by the normalized path.
+                 * @return The node for exactly that path, or null if there isn't one or the host isn't this site's.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Node* route(std::string_view url);
+
                 /**
                  * @brief Copy operator overwrite.
                  * @param other A reference to another instance.
@@ -315,8 +1366,9 @@ namespace HTTP {
          * @date 6/10/25
          */
         struct Data {
-            int id; ///< The id of the client read from.
+            int id; ///< The id of the client read from, which is its fd.
             std::shared_ptr<Sockets::Socket> client; ///< A shared pointer to a client that was read from.
+            uint64_t sequence; ///< The request's place among those read from its connection, responses are written in this order.
             enum {
                 REQUEST,
                 RESPONSE
@@ -331,11 +1383,12 @@ namespace HTTP {
              * @param id The id of the client the data comes from.
              * @param client The client the data comes from.
              * @param request The request of the data.
+             * @param sequence The request's place among those read from its connection.
              * @author banana584
              * @date 6/10/25
              */
-            Data(int id, std::shared_ptr<Sockets::Socket> client, Requests::HTTPRequest request) 
-                : id(id), client(client), request(request) {type = REQUEST;}
+            Data(int id, std::shared_ptr<Sockets::Socket> client, Requests::HTTPRequest request, uint64_t sequence = 0)
+                : id(id), client(client), sequence(sequence), request(request) {type = REQUEST;}
 
             /**
              * @brief Constructor.
@@ -346,12 +1399,152 @@ namespace HTTP {
              * @date 6/10/25
              */
             Data(int id, std::shared_ptr<Sockets::Socket> client, Responses::HTTPResponse response)
-                : id(id), client(client), response(response) {type = RESPONSE;}
+                : id(id), client(client), sequence(0), response(response) {type = RESPONSE;}
+
+            /**
+             * @brief Destructor the clean up resources, destroying whichever member is in use so a spilled body's temp file is closed.
+             */
+            ~Data() {
+                if (type == REQUEST) {
+                    request.~HTTPRequest();
+                } else {
+                    response.~HTTPResponse();
+                }
+            }
+        };
+
+        /**
+         * @enum ConnectionState
+         * @brief The stage a client connection is at in the reactor.
+         * @author banana584
+         * @date 17/10/26
+         */
+        enum class ConnectionState {
+            ReadingHeaders, ///< Some of a request has arrived but not the full header block.
+            ReadingBody, ///< Headers are in, waiting for the rest of the body.
+            Writing, ///< No more requests are read until the responses to those already read are written, because the connection is closing or too many are waiting.
+            Idle, ///< Waiting for the next request on a keep-alive connection, responses to earlier ones may still be going out.
+            Closing ///< The connection is finished and will be closed.
+        };
+
+        /**
+         * @struct OutputSegment
+         * @brief A piece of a response waiting to be written, either bytes in memory or a range of a file.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct OutputSegment {
+            std::string data; ///< The bytes to write when file is null.
+            std::shared_ptr<Responses::FileBody> file; ///< A file to send from with sendfile, or null.
+            off_t file_offset = 0; ///< Where in the file the segment starts.
+            size_t file_length = 0; ///< The number of bytes of the file in the segment.
+            std::shared_ptr<const Cache::Entry> cached; ///< A file in a cache to write instead of data, or null.
+            Cache::Encoding encoding = Cache::Encoding::Identity; ///< Which of cached's encodings is written.
+
+            /**
+             * @brief Returns the size of the segment.
+             * @return The number of bytes in the segment.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t size() const { return file ? file_length : bytes().size(); }
 
             /**
-             * @brief Destructor the clean up resources.
+             * @brief Returns the bytes of a memory segment.
+             * @return The cached file's bytes in its encoding if there is one, otherwise data.
+             * @author banana584
+             * @date 17/10/26
              */
-            ~Data() {}
+            std::string_view bytes() const { return cached ? cached->get_data(encoding) : std::string_view(data); }
+        };
+
+        /**
+         * @class Connection
+         * @brief State kept by the reactor for every accepted client.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class Connection {
+            public:
+                std::shared_ptr<Sockets::Socket> client; ///< The client socket.
+                ConnectionState state; ///< The current state of the connection.
+                Buffers::RecvBuffer input; ///< Bytes read from the client that have not been handled yet, in a block from the server's pool.
+                HTTP::Requests::RequestParser parser; ///< Parses the current request's headers as they arrive.
+                std::deque<OutputSegment> output; ///< Segments waiting to be written, kept separate so memory ones can go out with one writev and files with sendfile.
+                size_t output_offset; ///< How much of the first output buffer has already been written.
+                size_t output_bytes; ///< The bytes of memory segments still waiting to be written.
+                bool reading_paused; ///< If reading was paused because too much output is waiting or too many requests are waiting on responses or parsing.
+                std::unique_ptr<HTTP::Requests::HTTPRequest> request; ///< The request whose body is being read, null otherwise.
+                HTTP::Requests::BodyDecoder body_decoder; ///< Takes the framing off the current request's body.
+                std::shared_ptr<HTTP::Requests::RequestBody> body; ///< The current request's body so far, null until any arrives.
+                size_t max_body_size; ///< The largest body the current request's route accepts.
+                bool keep_alive; ///< If the connection should stay open after the response is written.
+                bool peer_closed; ///< If the client has shut down its side of the connection.
+                bool unread; ///< If the last read stopped at its limit, so the socket may hold data edge-triggered epoll won't report again.
+                bool send_in_flight; ///< If the backend is sending output, which must not change until it finishes.
+                bool close_sent; ///< If the send in flight is linked to closing the socket.
+                uint64_t next_sequence; ///< The sequence number the next request read is given.
+                uint64_t next_response; ///< The sequence number of the request whose response goes out next.
+                std::map<uint64_t, std::vector<OutputSegment>> held; ///< Responses built before an earlier request's, kept by sequence number until their turn.
+                uint64_t request_start; ///< When the first byte of the current request arrived, in milliseconds from Timers::Now.
+                Timers::Timer timer; ///< The deadline for the current state, with the client's fd as its id.
+            public:
+                /**
+                 * @brief Constructor.
+                 * @param client The accepted client socket.
+                 * @param pool The pool input buffers are taken from.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Connection(std::shared_ptr<Sockets::Socket> client, Buffers::SlabPool& pool);
+
+                /**
+                 * @brief Destructor to clean up resources.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ~Connection();
+        };
+
+        /**
+         * @struct ServerConfig
+         * @brief Options for how a server listens and handles clients.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct ServerConfig {
+            std::string address = "0.0.0.0"; ///< The address to listen on.
+            int port = 8080; ///< The port to listen on.
+            bool reuse_port = false; ///< If SO_REUSEPORT should be set so several servers can listen on the same port.
+            int backlog = SOMAXCONN; ///< The size of the listen backlog.
+            IO::BackendType backend = IO::BackendType::Epoll; ///< The I/O backend, io_uring falls back to epoll if the kernel doesn't support it.
+            size_t max_header_size = 8192; ///< The largest request line and header block allowed before answering with 431.
+            int header_timeout = 10000; ///< The milliseconds a client has from the start of a request, or from connecting, to send every header.
+            int body_timeout = 30000; ///< The most milliseconds allowed between reads of a request body.
+            int keep_alive_timeout = 5000; ///< The milliseconds an idle keep-alive connection is kept open for.
+            int request_timeout = 60000; ///< The milliseconds a whole request may take, from its first byte to its response being written.
+            size_t output_high_water = 1048576; ///< The bytes of queued output in memory that stops reading from a client until half of it is written.
+            size_t max_body_size = 8388608; ///< The largest request body allowed before answering with 413, routes can set their own.
+            size_t body_spill_threshold = 65536; ///< The size above which a request body is moved from memory into a temp file.
+            std::string temp_directory = "/tmp"; ///< The directory request bodies spill into.
+            uint64_t max_pipeline_depth = 16; ///< The most requests read from one connection ahead of their responses, reading from the socket is paused until some are written.
+            size_t content_cache_size = 67108864; ///< The bytes of static files kept in memory, 0 to send every file from disk.
+            std::shared_ptr<Cache::ContentCache> content_cache; ///< A cache to share with other servers, if null a pool makes one for all its workers and a lone server makes its own from content_cache_size.
+        };
+
+        /**
+         * @struct AcceptStats
+         * @brief Counters for how a server is accepting clients.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct AcceptStats {
+            uint64_t wakeups = 0; ///< The number of times the listener woke the server up.
+            uint64_t accepted = 0; ///< The total number of clients accepted.
+            uint64_t last_batch = 0; ///< The number of clients accepted on the last wake up.
+            uint64_t max_batch = 0; ///< The most clients accepted on a single wake up.
+            uint64_t backlog_full = 0; ///< The number of wake ups where the backlog was full so new connections were being dropped.
+            uint64_t errors = 0; ///< The number of wake ups that ended with an accept error such as running out of fds.
         };
 
         /**
@@ -365,26 +1558,179 @@ namespace HTTP {
                 std::mutex sockets_mutex; ///< A mutex to protect sockets.
             protected:
                 std::unique_ptr<Sockets::Socket> socket; ///< A unique pointer to the server socket.
-                int epoll_fd; ///< The epoll fd of the server - for using epoll on clients.
-                struct epoll_event events[100]; ///< An array of epoll events - will change to a vector later. // Temporary value, TODO: Change to be dynamic or have a set value chosen in constructor.
+                std::unique_ptr<IO::Backend> backend; ///< The backend waiting on the listener, wake fd and clients.
+                std::vector<IO::Event> ready; ///< Events from the last wait, reused between waits.
+                int wake_fd; ///< An eventfd watched by the backend used to wake the server up when it is stopped.
+                std::atomic<uint64_t> accept_wakeups; ///< The number of times the listener woke the server up.
+                std::atomic<uint64_t> accept_total; ///< The total number of clients accepted.
+                std::atomic<uint64_t> accept_last_batch; ///< The number of clients accepted on the last wake up.
+                std::atomic<uint64_t> accept_max_batch; ///< The most clients accepted on a single wake up.
+                std::atomic<uint64_t> accept_backlog_full; ///< The number of wake ups where the backlog was full.
+                std::atomic<uint64_t> accept_errors; ///< The number of wake ups that ended with an accept error.
                 Responses::ResponseBuilder response_builder; ///< An instance of the response builder class for handling clients.
+                ServerConfig config; ///< The options the server was created with.
+                Buffers::SlabPool buffer_pool; ///< The pool connection input buffers come from, declared before connections so it outlives them.
+                Timers::TimingWheel timers; ///< The deadlines of every connection and of the handling loop.
+                std::vector<Timers::Timer*> expired; ///< Timers that fired on the last wait, reused between waits.
+                Timers::Timer run_timer; ///< The deadline of HandleClients or StartClientsHandleThread when given a timeout.
+                bool run_expired; ///< If run_timer has fired.
+                std::vector<std::shared_ptr<Connection>> connections; ///< Every open connection indexed by its fd, null where an fd isn't a connection.
+                std::vector<int> pending; ///< Connections that went idle with unhandled input still buffered, or whose last read stopped at its limit.
             public:
-                bool running; ///< A value on if the server is running.
+                std::atomic<bool> running; ///< A value on if the server is running.
             private:
                 /**
-                 * @brief Accepts a client and sets up epoll to work for them.
+                 * @brief Accepts every waiting client and registers them with the backend.
                  * @author banana584
                  * @date 6/10/25
                  */
                 void AcceptClients();
 
                 /**
-                 * @brief Starts a thread to accept clients.
+                 * @brief Starts tracking newly accepted clients and registers them with the backend.
+                 * @param accepted The accepted clients.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void RegisterClients(std::vector<std::shared_ptr<Sockets::Socket>>& accepted);
+
+                /**
+                 * @brief Creates the backend and registers the server socket and wake fd with it.
+                 * @param type The type of backend to use.
                  * @see AcceptClients.
                  * @author banana584
-                 * @date 6/10/25
+                 * @date 17/10/26
+                 */
+                void StartBackend(IO::BackendType type);
+
+                /**
+                 * @brief Handles a backend event for a connection.
+                 * @param event The event.
+                 * @param completed Filled with any request that was fully read.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void HandleEvent(const IO::Event& event, std::vector<std::unique_ptr<Data>>& completed);
+                /**
+                 * @brief Waits for backend events and moves every ready connection forward.
+                 * @param completed Filled with every request that was fully read during this poll.
+                 * @warning sockets_mutex must not be held when calling this.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void PollClients(std::vector<std::unique_ptr<Data>>& completed);
+
+                /**
+                 * @brief Runs the connection's state machine as far as the buffered data allows.
+                 * @param connection The connection to advance.
+                 * @param completed Filled with the request if one was fully read.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void AdvanceConnection(Connection& connection, std::vector<std::unique_ptr<Data>>& completed);
+
+                /**
+                 * @brief Adds a segment to the end of a connection's output.
+                 * @param connection The connection.
+                 * @param segment The segment to write after everything already queued.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void QueueOutput(Connection& connection, OutputSegment segment);
+
+                /**
+                 * @brief Puts a response in a connection's output in the order its request was read, holding it back if an earlier response isn't in yet.
+                 * @param connection The connection.
+                 * @param sequence The sequence number of the request being answered.
+                 * @param response The response, which is moved from.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void QueueResponse(Connection& connection, uint64_t sequence, Responses::HTTPResponse& response);
+
+                /**
+                 * @brief Writes what a connection has queued and closes it or moves its deadline depending on where that leaves it.
+                 * @param fd The fd of the connection.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void FinishWrite(int fd);
+
+                /**
+                 * @brief Answers a request that can't be handled with an empty error response and closes the connection once it is sent.
+                 * @param connection The connection.
+                 * @param status The status to answer with, e.g 400.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void RejectRequest(Connection& connection, int status);
+
+                /**
+                 * @brief Pauses reading from a connection whose output is over the high-water mark or whose pipeline is full, or resumes it once half the output has drained and the pipeline and input buffer have room.
+                 * @param connection The connection.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void UpdateBackpressure(Connection& connection);
+
+                /**
+                 * @brief Writes as much of a connection's pending output as the socket will take.
+                 * @param connection The connection to flush.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void FlushConnection(Connection& connection);
+
+                /**
+                 * @brief Reads what is waiting on a connection's socket, a limited amount at a time so a body is decoded and spilled as it arrives rather than buffered whole, and headers never past max_header_size.
+                 * @param connection The connection.
+                 * @warning Connections left with unread data are added to pending.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void ReadConnection(Connection& connection);
+
+                /**
+                 * @brief Arms a connection's timer for the deadline of the state it is in.
+                 * @param connection The connection.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void ArmTimer(Connection& connection);
+
+                /**
+                 * @brief Closes every connection whose deadline has passed.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void ExpireTimers();
+
+                /**
+                 * @brief Handles clients until the server stops, the stop flag is set or the timeout fires on the timing wheel.
+                 * @param stop_flag A flag on when to stop, or null.
+                 * @param timeout A timeout in seconds, if there is no timeout enter -1.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void RunClients(std::shared_ptr<bool> stop_flag, int timeout);
+
+                /**
+                 * @brief Finds the connection for an fd.
+                 * @param fd The fd of the connection.
+                 * @return The connection, or null if fd isn't one.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Connection* FindConnection(int fd);
+
+                /**
+                 * @brief Removes a connection from the backend and closes it.
+                 * @param fd The fd of the connection to close.
+                 * @warning If the backend is still sending the connection's output the socket is only shut down, the connection is closed when the Sent event arrives.
+                 * @author banana584
+                 * @date 17/10/26
                  */
-                void StartAcceptThread();
+                void CloseConnection(int fd);
             public:
                 /**
                  * @brief Constructor
@@ -394,6 +1740,15 @@ namespace HTTP {
                  */
                 HTTPServer(std::string website_tree_filename);
 
+                /**
+                 * @brief Constructor
+                 * @param website_tree_filename The name of the file to be parsed by ResponseBuilder.
+                 * @param config Options for how the server listens.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HTTPServer(std::string website_tree_filename, ServerConfig config);
+
                 /**
                  * @brief Destructor to clean up resources
                  * @author banana584
@@ -401,10 +1756,41 @@ namespace HTTP {
                  */
                 ~HTTPServer();
 
+                /**
+                 * @brief Stops the server and wakes it up if it is waiting for events.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Stop();
+
+                /**
+                 * @brief Returns the type of backend the server ended up using.
+                 * @return The backend type.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                IO::BackendType get_backend_type();
+
+                /**
+                 * @brief Returns the server socket.
+                 * @return A reference to the socket the server listens on.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Sockets::Socket& get_socket();
+
+                /**
+                 * @brief Returns counters for accepting clients.
+                 * @return A snapshot of the accept counters.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                AcceptStats get_accept_stats();
+
                 /**
                  * @brief Reads data from a client by id.
-                 * @param id The id of the client to read data from.
-                 * @warning Is blocking so either know this client is ready to be read from or wait.
+                 * @param id The id of the client to read data from, which is its fd.
+                 * @warning Is blocking so either know this client is ready to be read from or wait. Only clients the server socket accepted itself can be read, connections the reactor drives throw std::invalid_argument.
                  * @return A unique pointer to an instance of the Data struct.
                  * @see Data
                  * @author banana584
@@ -415,7 +1801,7 @@ namespace HTTP {
                 /**
                  * @brief Reads data from a client by socket reference.
                  * @param client A reference to a socket to read from.
-                 * @warning Is blocking so either know this client is ready to be read from or wait.
+                 * @warning Is blocking so either know this client is ready to be read from or wait. Only clients the server socket accepted itself can be read, connections the reactor drives throw std::invalid_argument.
                  * @return A unique pointer to an instance of the Data struct.
                  * @see Data
                  * @author banana584
@@ -434,7 +1820,7 @@ namespace HTTP {
 
                 /**
                  * @brief Write a response to a client by id.
-                 * @param id The id of the client to write to.
+                 * @param id The id of the client to write to, which is its fd.
                  * @param request A reference of a HTTPRequest to generate a response to and write.
                  * @warning Is blocking until message is finished writing.
                  * @return 0 for success otherwise an error.
@@ -447,13 +1833,33 @@ namespace HTTP {
                  * @brief Write a response to a client by socket reference.
                  * @param client A reference to a socket to write to.
                  * @param request A reference of a HTTPRequest to generate a response to and write.
-                 * @warning Is blocking until message is finished writing.
+                 * @warning If the client is a reactor connection the response is queued and whatever the socket can not take yet is sent on EPOLLOUT, otherwise this blocks until the message is finished writing.
+                 * @warning A reactor connection's response is taken as the answer to its oldest request without one, use the overload taking Data when answering out of order.
                  * @return 0 for success otherwise an error.
                  * @author banana584
                  * @date 6/10/25
                  */
                 int WriteClient(Sockets::Socket& client, Requests::HTTPRequest& request);
 
+                /**
+                 * @brief Write a response to a request that was read, in the order requests were read from its connection.
+                 * @param data The request, as given by ReadClient or ReadClients.
+                 * @warning Responses that are ready before an earlier request's are held back until it is answered.
+                 * @return 0 for success otherwise an error.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                int WriteClient(Data& data);
+
+                /**
+                 * @brief Writes responses to every request that was read, flushing each connection once so pipelined responses go out together.
+                 * @param data The requests, as given by ReadClients.
+                 * @return 0 for success otherwise an error.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                int WriteClients(std::vector<std::unique_ptr<Data>>& data);
+
                 /**
                  * @brief Reads from a client and writes a response by id.
                  * @param id The id of the client to handle.
@@ -545,7 +1951,225 @@ namespace HTTP {
                  */
                 void HandleClients(int timeout);
         };
+
+        /**
+         * @class HTTPServerPool
+         * @brief Runs several HTTPServers on one port, each with its own SO_REUSEPORT listener, backend, connections and thread, sharing one content cache.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class HTTPServerPool {
+            protected:
+                std::vector<std::unique_ptr<HTTPServer>> servers; ///< One server per worker.
+                std::vector<std::thread> threads; ///< The threads running the servers.
+                bool cpu_steering; ///< If connections are steered to the worker on the CPU they arrived on.
+            public:
+                /**
+                 * @brief Constructor.
+                 * @param website_tree_filename The name of the file to be parsed by every worker's ResponseBuilder.
+                 * @param config Options for how the workers listen, reuse_port is always turned on and one content cache is shared by every worker.
+                 * @param workers The number of workers to start, 0 to use the number of cores.
+                 * @param cpu_steering If a CBPF program should steer connections by CPU, which pins worker i to CPU i.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HTTPServerPool(std::string website_tree_filename, ServerConfig config, int workers = 0, bool cpu_steering = false);
+
+                /**
+                 * @brief Destructor that stops and joins every worker.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ~HTTPServerPool();
+
+                /**
+                 * @brief Starts a thread for every worker to handle clients.
+                 * @param timeout A timeout for the handling, if there is no timeout enter -1.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Start(int timeout);
+
+                /**
+                 * @brief Starts every worker and waits for them to finish.
+                 * @param timeout A timeout for the handling, if there is no timeout enter -1.
+                 * @warning Blocks until every worker stops.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void HandleClients(int timeout);
+
+                /**
+                 * @brief Stops every worker and joins their threads.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void Stop();
+
+                /**
+                 * @brief Returns the number of workers.
+                 * @return The number of workers in the pool.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t size();
+        };
+    }
+
+    /**
+     * @namespace Clients
+     * @brief A subset of the HTTP namespace that has classes for making requests to other servers.
+     * @author banana584
+     * @date 17/10/26
+     */
+    namespace Clients {
+        /**
+         * @struct ClientConfig
+         * @brief Options for how a client keeps and uses connections.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct ClientConfig {
+            size_t max_idle_per_host = 8; ///< The most idle connections kept open to each host and port.
+            int idle_timeout = 30000; ///< The milliseconds an idle connection is kept before it is closed instead of reused.
+            int response_timeout = 30000; ///< The most milliseconds to wait for more of a response before giving up.
+            size_t max_body_size = 8388608; ///< The largest response body accepted.
+        };
+
+        /**
+         * @struct ClientStats
+         * @brief Counters for how a client is using connections.
+         * @author banana584
+         * @date 17/10/26
+         */
+        struct ClientStats {
+            uint64_t requests = 0; ///< The number of requests sent.
+            uint64_t connected = 0; ///< The number of new connections made.
+            uint64_t reused = 0; ///< The number of requests sent on an idle connection from the pool.
+            uint64_t retried = 0; ///< The number of requests sent again because a pooled connection had been closed by the other side.
+        };
+
+        /**
+         * @class ClientConnection
+         * @brief A connection to a server with the bytes read from it that haven't been parsed.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class ClientConnection {
+            public:
+                std::unique_ptr<Sockets::Socket> socket; ///< The connected socket.
+                Buffers::RecvBuffer input; ///< Bytes read from the server, in a block from the client's pool.
+                uint64_t idle_since; ///< When the connection was put back in the pool, in milliseconds from Timers::Now.
+            public:
+                /**
+                 * @brief Constructor.
+                 * @param socket The connected socket.
+                 * @param pool The pool input buffers are taken from.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ClientConnection(std::unique_ptr<Sockets::Socket> socket, Buffers::SlabPool& pool) : socket(std::move(socket)), input(pool), idle_since(0) {}
+        };
+
+        /**
+         * @class HTTPClient
+         * @brief A HTTP/1.1 client that keeps connections to each host and port open between requests.
+         * @warning Not thread-safe, each thread should keep its own client.
+         * @author banana584
+         * @date 17/10/26
+         */
+        class HTTPClient {
+            private:
+                ClientConfig config; ///< The options the client was created with.
+                Buffers::SlabPool buffer_pool; ///< The pool connection input buffers come from, declared before idle so it outlives them.
+                std::map<std::string, std::vector<std::unique_ptr<ClientConnection>>> idle; ///< Idle connections by "ip:port", most recently used last.
+                ClientStats stats; ///< Counters for how connections are used.
+            private:
+                /**
+                 * @brief Takes an idle connection to a server from the pool, or connects a new one.
+                 * @param ip The IPv4 address of the server.
+                 * @param port The port of the server.
+                 * @param reused Set to if the connection came from the pool.
+                 * @return The connection.
+                 */
+                std::unique_ptr<ClientConnection> Acquire(const std::string& ip, int port, bool& reused);
+
+                /**
+                 * @brief Puts a connection back in the pool, or closes it if the pool for its server is full.
+                 * @param key The "ip:port" of the server.
+                 * @param connection The connection.
+                 */
+                void Release(const std::string& key, std::unique_ptr<ClientConnection> connection);
+
+                /**
+                 * @brief Sends a request on a connection and reads the response.
+                 * @param connection The connection.
+                 * @param raw The whole request.
+                 * @param no_body If the response can't have a body.
+                 * @param responded Set to true once any of the response has arrived.
+                 * @param keep_alive Set to if the connection can be used again.
+                 * @return The response.
+                 */
+                Responses::HTTPResponse Exchange(ClientConnection& connection, std::string& raw, bool no_body, bool& responded, bool& keep_alive);
+            public:
+                /**
+                 * @brief Constructor.
+                 * @param config Options for how connections are kept and used.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                HTTPClient(ClientConfig config = ClientConfig());
+
+                /**
+                 * @brief Sends a request to a server and waits for the response, reusing an idle connection to it if there is one.
+                 * @param ip The IPv4 address of the server.
+                 * @param port The port of the server.
+                 * @param request The request, Host and Content-Length are added if missing.
+                 * @return The response.
+                 * @throws std::runtime_error If connecting, sending or receiving fails or times out.
+                 * @throws std::invalid_argument If the response is malformed or too large.
+                 * @warning Idempotent requests are sent again on a new connection if a pooled one turns out to have been closed, others are not.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Responses::HTTPResponse Request(const std::string& ip, int port, Requests::HTTPRequest& request);
+
+                /**
+                 * @brief Sends a GET request to a server and waits for the response.
+                 * @param ip The IPv4 address of the server.
+                 * @param port The port of the server.
+                 * @param target The path and query to get, e.g "/health".
+                 * @return The response.
+                 * @see Request
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                Responses::HTTPResponse Get(const std::string& ip, int port, const std::string& target);
+
+                /**
+                 * @brief Closes every idle connection.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                void CloseIdle();
+
+                /**
+                 * @brief Returns the number of idle connections in the pool.
+                 * @return The number of connections.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                size_t idle_size();
+
+                /**
+                 * @brief Returns counters for how connections are used.
+                 * @return A snapshot of the counters.
+                 * @author banana584
+                 * @date 17/10/26
+                 */
+                ClientStats get_stats();
+        };
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,235 @@
+#ifndef NETWORKING_BUFFERS_BUFFERS_HPP
+#define NETWORKING_BUFFERS_BUFFERS_HPP
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <string_view>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * @namespace Buffers
+ * @brief This namespace contains pooled memory for reading from clients without allocating on every read.
+ * @author banana584
+ * @date 17/10/26
+ */
+namespace Buffers {
+    /**
+     * @class SlabPool
+     * @brief Hands out blocks in power of 2 size classes, carved from large slabs and kept on free lists once given back.
+     * @warning Not thread-safe, each server keeps its own pool.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class SlabPool {
+        private:
+            size_t min_block; ///< The size of the smallest class.
+            size_t max_block; ///< The size of the largest class, bigger blocks come from the heap.
+            size_t slab_size; ///< The size of each slab blocks are carved from.
+            std::vector<std::vector<char*>> free_blocks; ///< The free blocks of each class.
+            std::vector<std::unique_ptr<char[]>> slabs; ///< Every slab, freed with the pool.
+            size_t in_use; ///< The number of bytes handed out and not given back.
+        private:
+            /**
+             * @brief Finds the class a size belongs to.
+             * @param size The size wanted.
+             * @return The index of the smallest class that fits size.
+             */
+            size_t ClassOf(size_t size);
+        public:
+            /**
+             * @brief Constructor.
+             * @param min_block The size of the smallest block, a power of 2.
+             * @param max_block The size of the largest pooled block, a power of 2.
+             * @param slab_size The size of each slab, at least max_block.
+             * @author banana584
+             * @date 17/10/26
+             */
+            SlabPool(size_t min_block = 4096, size_t max_block = 65536, size_t slab_size = 262144);
+
+            /**
+             * @brief Copying is disabled since blocks point into owned slabs.
+             */
+            SlabPool(const SlabPool& other) = delete;
+
+            /**
+             * @brief Copying is disabled since blocks point into owned slabs.
+             */
+            SlabPool& operator=(const SlabPool& other) = delete;
+
+            /**
+             * @brief Destructor to clean up resources.
+             * @warning Every block must have been given back first.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~SlabPool();
+
+            /**
+             * @brief Takes a block.
+             * @param size The least number of bytes wanted.
+             * @param capacity Set to the real size of the block, which is needed to give it back.
+             * @return The block.
+             * @author banana584
+             * @date 17/10/26
+             */
+            char* Acquire(size_t size, size_t& capacity);
+
+            /**
+             * @brief Gives a block back.
+             * @param block A block from Acquire.
+             * @param capacity The capacity Acquire gave for the block.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Release(char* block, size_t capacity);
+
+            /**
+             * @brief Returns the number of bytes handed out and not given back.
+             * @return The bytes in use.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t get_in_use();
+    };
+
+    /**
+     * @class RecvBuffer
+     * @brief A growable buffer backed by a SlabPool block with read and write cursors.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class RecvBuffer {
+        private:
+            SlabPool* pool; ///< The pool blocks are taken from.
+            char* block; ///< The current block or null if none is held.
+            size_t capacity; ///< The size of the current block.
+            size_t read_pos; ///< Where unread data starts.
+            size_t write_pos; ///< Where unread data ends and free space starts.
+        public:
+            /**
+             * @brief Constructor, no block is taken until data arrives.
+             * @param pool The pool to take blocks from, which must outlive the buffer.
+             * @author banana584
+             * @date 17/10/26
+             */
+            RecvBuffer(SlabPool& pool);
+
+            /**
+             * @brief Copying is disabled since the block is owned.
+             */
+            RecvBuffer(const RecvBuffer& other) = delete;
+
+            /**
+             * @brief Copying is disabled since the block is owned.
+             */
+            RecvBuffer& operator=(const RecvBuffer& other) = delete;
+
+            /**
+             * @brief Destructor to clean up resources.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~RecvBuffer();
+
+            /**
+             * @brief Returns the unread data.
+             * @return A pointer to the first unread byte.
+             * @author banana584
+             * @date 17/10/26
+             */
+            const char* data() const { return block + read_pos; }
+
+            /**
+             * @brief Returns the unread data for rewriting in place, e.g to normalize a request target.
+             * @return A pointer to the first unread byte.
+             * @author banana584
+             * @date 17/10/26
+             */
+            char* data() { return block + read_pos; }
+
+            /**
+             * @brief Returns the amount of unread data.
+             * @return The number of unread bytes.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t size() const { return write_pos - read_pos; }
+
+            /**
+             * @brief Returns if there is no unread data.
+             * @return True if empty.
+             * @author banana584
+             * @date 17/10/26
+             */
+            bool empty() const { return write_pos == read_pos; }
+
+            /**
+             * @brief Returns the unread data as a view.
+             * @return A view valid until the buffer is next written to.
+             * @author banana584
+             * @date 17/10/26
+             */
+            std::string_view view() const { return std::string_view(data(), size()); }
+
+            /**
+             * @brief Makes room for at least some bytes after the unread data, compacting before growing.
+             * @param size The least number of free bytes wanted.
+             * @return A pointer to the free space, which is at least size bytes.
+             * @author banana584
+             * @date 17/10/26
+             */
+            char* Reserve(size_t size);
+
+            /**
+             * @brief Returns the free space after the unread data.
+             * @return The number of bytes that can be written at the pointer from Reserve.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t get_free() const { return capacity - write_pos; }
+
+            /**
+             * @brief Marks bytes written into the space from Reserve as unread data.
+             * @param size The number of bytes written.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Commit(size_t size);
+
+            /**
+             * @brief Copies bytes onto the end of the unread data.
+             * @param bytes The bytes to copy.
+             * @param size The number of bytes.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Append(const char* bytes, size_t size);
+
+            /**
+             * @brief Marks bytes as read.
+             * @param size The number of bytes read from the front.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Consume(size_t size);
+
+            /**
+             * @brief Moves unread data to the start of the block.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Compact();
+
+            /**
+             * @brief Gives the block back to the pool if there is no unread data.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Release();
+    };
+}
+
+#endif
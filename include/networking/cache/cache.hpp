@@ -0,0 +1,441 @@
+#ifndef NETWORKING_CACHE_CACHE_HPP
+#define NETWORKING_CACHE_CACHE_HPP
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+
+/**
+ * @namespace Cache
+ * @brief This namespace contains caches that keep static files in memory so serving them doesn't touch the filesystem.
+ * @author banana584
+ * @date 17/10/26
+ */
+namespace Cache {
+    /**
+     * @brief Returns the media type of a file from its extension.
+     * @param path The path of the file.
+     * @return The media type, text/html if the extension isn't known since that is what pages were always served as.
+     * @author banana584
+     * @date 17/10/26
+     */
+    std::string_view ContentType(std::string_view path);
+
+    /**
+     * @brief Returns if a media type is worth compressing, i.e text and formats built on it rather than already compressed images, fonts and archives.
+     * @param type The media type.
+     * @return If it is compressible.
+     * @author banana584
+     * @date 17/10/26
+     */
+    bool Compressible(std::string_view type);
+
+    /**
+     * @brief Writes a time as an HTTP date, e.g "Sun, 06 Nov 1994 08:49:37 GMT".
+     * @param time The time.
+     * @param out Where to write the date, which takes 29 characters and a null terminator.
+     * @author banana584
+     * @date 17/10/26
+     */
+    void FormatDate(time_t time, char* out);
+
+    /**
+     * @brief Returns a strong entity tag for a file from its inode, size and modification time, which change whenever its contents are replaced.
+     * @param info The file's status.
+     * @param suffix Added to the tag so each encoding of the file has its own, empty for identity.
+     * @return The tag including its quotes.
+     * @author banana584
+     * @date 17/10/26
+     */
+    std::string EntityTag(const struct stat& info, std::string_view suffix);
+
+    /**
+     * @enum Encoding
+     * @brief The content codings a cached file can be sent in.
+     * @author banana584
+     * @date 17/10/26
+     */
+    enum class Encoding : uint8_t {
+        Identity, ///< The file as it is.
+        Gzip, ///< Compressed in the gzip format.
+        Deflate ///< Compressed in the zlib format, which is what HTTP calls deflate.
+    };
+
+    /**
+     * @struct Variant
+     * @brief A compressed copy of a cached file.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct Variant {
+        std::string data; ///< The compressed bytes, empty if compressing didn't make the file smaller.
+        std::string header_block; ///< The Content-Type, Content-Encoding, Content-Length, ETag, Last-Modified and Vary header lines, each ended by CRLF.
+        std::string etag; ///< The variant's own entity tag.
+        std::string not_modified_block; ///< The header lines of a 304 response for the variant.
+    };
+
+    /**
+     * @struct EpochRecord
+     * @brief What one thread announces to epoch-based reclamation, records are reused by later threads but never freed.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct EpochRecord {
+        std::atomic<uint64_t> epoch{0}; ///< The epoch the thread entered its read at, 0 when it isn't reading.
+        std::atomic<bool> in_use{false}; ///< If a thread owns the record.
+        EpochRecord* next = nullptr; ///< The next record in the list of every record.
+    };
+
+    /**
+     * @class EpochGuard
+     * @brief Marks the calling thread as reading for as long as it lives, so nothing it could see is freed under it.
+     * @warning Guards must not nest on one thread.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class EpochGuard {
+        private:
+            EpochRecord& record; ///< The calling thread's record.
+        public:
+            /**
+             * @brief Constructor that enters the current epoch.
+             * @author banana584
+             * @date 17/10/26
+             */
+            EpochGuard();
+
+            /**
+             * @brief Copying is disabled since the guard is tied to its thread.
+             */
+            EpochGuard(const EpochGuard& other) = delete;
+
+            /**
+             * @brief Copying is disabled since the guard is tied to its thread.
+             */
+            EpochGuard& operator=(const EpochGuard& other) = delete;
+
+            /**
+             * @brief Destructor that leaves the epoch.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~EpochGuard();
+    };
+
+    /**
+     * @struct Entry
+     * @brief A copy of a file in a read-only mapping with the headers that describe it, never changed once cached so it can be shared by every response and thread.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct Entry {
+        std::string path; ///< The path the file was read from.
+        std::string_view data; ///< The contents of the file, in the mapping.
+        std::string header_block; ///< The Content-Type, Content-Length, ETag and Last-Modified header lines, and Vary if there are compressed variants, each ended by CRLF.
+        std::string etag; ///< The entity tag of the file as it is.
+        std::string not_modified_block; ///< The header lines of a 304 response for the file as it is, its validators and Vary.
+        Variant gzip; ///< The file compressed with gzip.
+        Variant deflate; ///< The file compressed with deflate.
+        timespec mtime; ///< When the file was last modified.
+        void* mapping = nullptr; ///< The read-only mapping holding a copy of the file, null for an empty file.
+        size_t mapping_length = 0; ///< The length of the mapping, which can be longer than data if the file shrank while read.
+        mutable std::atomic<bool> referenced{true}; ///< Set on every hit and cleared as the clock hand passes, entries not hit since are evicted.
+        mutable size_t clock_index = 0; ///< Where the entry is in the clock, only touched with the cache's mutex held.
+
+        /**
+         * @brief Default constructor.
+         * @author banana584
+         * @date 17/10/26
+         */
+        Entry() = default;
+
+        /**
+         * @brief Copying is disabled since the mapping is owned.
+         */
+        Entry(const Entry& other) = delete;
+
+        /**
+         * @brief Copying is disabled since the mapping is owned.
+         */
+        Entry& operator=(const Entry& other) = delete;
+
+        /**
+         * @brief Destructor that unmaps the file.
+         * @author banana584
+         * @date 17/10/26
+         */
+        ~Entry();
+
+        /**
+         * @brief Returns if the file can be sent in an encoding.
+         * @param encoding The encoding.
+         * @return If there are bytes for it, identity always has them.
+         * @author banana584
+         * @date 17/10/26
+         */
+        bool has(Encoding encoding) const;
+
+        /**
+         * @brief Returns the bytes to send for an encoding.
+         * @param encoding The encoding, which must be one the entry has.
+         * @return The file, compressed if asked for.
+         * @author banana584
+         * @date 17/10/26
+         */
+        std::string_view get_data(Encoding encoding) const;
+
+        /**
+         * @brief Returns the header lines describing the bytes sent for an encoding.
+         * @param encoding The encoding, which must be one the entry has.
+         * @return The header block.
+         * @author banana584
+         * @date 17/10/26
+         */
+        const std::string& get_header_block(Encoding encoding) const;
+
+        /**
+         * @brief Returns the entity tag of an encoding.
+         * @param encoding The encoding, which must be one the entry has.
+         * @return The tag including its quotes.
+         * @author banana584
+         * @date 17/10/26
+         */
+        const std::string& get_etag(Encoding encoding) const;
+
+        /**
+         * @brief Returns the header lines of a 304 response for an encoding.
+         * @param encoding The encoding, which must be one the entry has.
+         * @return The header block.
+         * @author banana584
+         * @date 17/10/26
+         */
+        const std::string& get_not_modified_block(Encoding encoding) const;
+
+        /**
+         * @brief Returns the bytes the entry takes from a cache's budget.
+         * @return The size of the file and every variant.
+         * @author banana584
+         * @date 17/10/26
+         */
+        size_t get_size() const;
+    };
+
+    /**
+     * @struct CacheStats
+     * @brief Counters for how a cache is being used.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct CacheStats {
+        uint64_t hits = 0; ///< The number of lookups served from memory.
+        uint64_t misses = 0; ///< The number of lookups that had to go to disk.
+        uint64_t evictions = 0; ///< The number of entries evicted to make room.
+        uint64_t invalidations = 0; ///< The number of entries dropped because their file changed.
+        size_t entries = 0; ///< The number of files held.
+        size_t bytes = 0; ///< The bytes of file contents held, compressed variants included.
+    };
+
+    /**
+     * @class ContentCache
+     * @brief Holds files in read-only mappings by path up to a byte budget, shared by every thread. Lookups search a sharded hash without locking, while the rare writes copy a shard's table and free the old one once no reader can see it. Eviction is CLOCK weighted by size, and entries are dropped when inotify reports a change in their directory. Compressible files are also held gzip and deflate compressed, made once when the file is read.
+     * @warning Files bigger than the whole budget aren't cached.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class ContentCache {
+        private:
+            static constexpr int SHARD_BITS = 4; ///< The bits of the hash that pick a shard.
+            static constexpr size_t SHARDS = 1 << SHARD_BITS; ///< The number of shards.
+
+            /**
+             * @struct Slot
+             * @brief A slot of a shard's open-addressed table.
+             */
+            struct Slot {
+                size_t hash = 0; ///< The hash of the entry's path.
+                std::shared_ptr<const Entry> entry; ///< The entry, null if the slot is empty.
+            };
+
+            /**
+             * @struct Table
+             * @brief A shard's table, which is never changed once published.
+             */
+            struct Table {
+                std::vector<Slot> slots; ///< The slots, a power of 2 of them at most half full.
+                size_t count = 0; ///< The number of entries.
+            };
+
+            /**
+             * @struct Shard
+             * @brief One shard on its own cache line, so threads hitting different shards don't share counters.
+             */
+            struct alignas(64) Shard {
+                std::atomic<const Table*> table{nullptr}; ///< The published table.
+                std::atomic<uint64_t> hits{0}; ///< Lookups served from this shard.
+            };
+
+            size_t budget; ///< The most bytes of file contents held.
+            size_t used; ///< The bytes of file contents held, compressed variants included.
+            uint64_t generation; ///< Bumped on every inotify event, so a file read while its directory changed isn't cached.
+            std::array<Shard, SHARDS> shards; ///< The shards, picked by the top bits of the hash.
+            std::vector<std::shared_ptr<const Entry>> clock; ///< Every entry, swept by the hand when room is needed.
+            size_t hand; ///< Where the next sweep starts.
+            std::vector<std::pair<uint64_t, const Table*>> retired; ///< Replaced tables with the epoch they were replaced in.
+            std::unordered_map<int, std::string> watches; ///< The directory of each inotify watch.
+            std::atomic<uint64_t> misses; ///< Lookups that went to disk.
+            std::atomic<uint64_t> evictions; ///< Entries evicted to make room.
+            std::atomic<uint64_t> invalidations; ///< Entries dropped because their file changed.
+            std::mutex mutex; ///< Guards every write, readers never take it.
+            int inotify_fd; ///< The inotify instance.
+            int wake_fd; ///< An eventfd that stops the watcher thread.
+            std::thread watcher; ///< Reads inotify events and drops what they touch.
+        private:
+            /**
+             * @brief Searches a shard without locking.
+             * @param path The path.
+             * @param hash The hash of the path.
+             * @return The entry, or null if it isn't held.
+             */
+            std::shared_ptr<const Entry> Find(const std::string& path, size_t hash);
+
+            /**
+             * @brief Publishes a copy of a shard's table with an entry added or removed, retiring the old one.
+             * @param hash The hash of the entry's path.
+             * @param entry The entry to add, or null to remove.
+             * @param path The path of the entry to remove.
+             * @warning mutex must be held.
+             */
+            void Replace(size_t hash, const std::shared_ptr<const Entry>& entry, const std::string& path);
+
+            /**
+             * @brief Takes an entry out of the shards and the clock and gives its bytes back to the budget.
+             * @param entry The entry.
+             * @warning mutex must be held.
+             */
+            void Drop(const std::shared_ptr<const Entry>& entry);
+
+            /**
+             * @brief Drops the entry for a path if there is one.
+             * @param path The path of the entry.
+             * @warning mutex must be held.
+             */
+            void Remove(const std::string& path);
+
+            /**
+             * @brief Drops every entry in a directory.
+             * @param directory The directory, as its watch has it, or empty for every entry.
+             * @warning mutex must be held.
+             */
+            void RemoveDirectory(const std::string& directory);
+
+            /**
+             * @brief Sweeps the clock, evicting entries that weren't hit since the hand last passed, until some bytes fit.
+             * @param size The bytes that need to fit.
+             * @warning mutex must be held.
+             */
+            void MakeRoom(size_t size);
+
+            /**
+             * @brief Frees retired tables that no reader can still see.
+             * @warning mutex must be held.
+             */
+            void Reclaim();
+
+            /**
+             * @brief Reads inotify events until woken by wake_fd.
+             */
+            void Watch();
+        public:
+            /**
+             * @brief Constructor that starts watching for changes.
+             * @param budget The most bytes of file contents to hold.
+             * @warning Throws std::runtime_error if inotify can't be set up.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ContentCache(size_t budget);
+
+            /**
+             * @brief Copying is disabled since the watcher thread points at this.
+             */
+            ContentCache(const ContentCache& other) = delete;
+
+            /**
+             * @brief Copying is disabled since the watcher thread points at this.
+             */
+            ContentCache& operator=(const ContentCache& other) = delete;
+
+            /**
+             * @brief Destructor that stops the watcher thread.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~ContentCache();
+
+            /**
+             * @brief Returns a file from memory, reading and caching it first if it isn't held.
+             * @param path The path of the file.
+             * @return The file, or null if it can't be cached, e.g it is bigger than the budget.
+             * @warning Throws std::runtime_error if the file can't be opened, read or mapped.
+             * @author banana584
+             * @date 17/10/26
+             */
+            std::shared_ptr<const Entry> Get(const std::string& path);
+
+            /**
+             * @brief Drops every entry.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Clear();
+
+            /**
+             * @brief Returns the number of files held.
+             * @return The number of files.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t size();
+
+            /**
+             * @brief Returns the bytes of file contents held.
+             * @return The bytes used from the budget.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t get_used();
+
+            /**
+             * @brief Returns the cache's counters.
+             * @return A copy of the counters.
+             * @author banana584
+             * @date 17/10/26
+             */
+            CacheStats get_stats();
+    };
+}
+
+#endif
@@ -0,0 +1,368 @@
+#ifndef NETWORKING_IO_IO_HPP
+#define NETWORKING_IO_IO_HPP
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+/**
+ * @namespace IO
+ * @brief This namespace contains the I/O backends a server can use to wait for and perform socket I/O.
+ * @author banana584
+ * @date 17/10/26
+ */
+namespace IO {
+    /**
+     * @enum BackendType
+     * @brief The kinds of backend that can drive a server.
+     * @author banana584
+     * @date 17/10/26
+     */
+    enum class BackendType {
+        Epoll, ///< Readiness based, the server does its own recv and send.
+        IOUring ///< Completion based, accepts, recvs and sends are done by the kernel and reported when finished.
+    };
+
+    /**
+     * @struct Event
+     * @brief Something that happened on an fd, reported by a backend.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct Event {
+        enum Type {
+            Accept, ///< The listener has clients waiting to be accepted.
+            Accepted, ///< The backend accepted a client, fd is the new client.
+            Readable, ///< fd has data waiting to be recieved.
+            Data, ///< Data was recieved into a backend buffer.
+            Writable, ///< fd can be written to again.
+            Sent, ///< A send started with Backend::Send finished, result is the bytes sent or -errno.
+            Hangup, ///< The other side shut down if result is 0, otherwise the connection broke with -errno.
+            Wake ///< The wake fd was triggered.
+        } type; ///< The type of the event.
+        int fd; ///< The fd the event is for.
+        ssize_t result; ///< The number of bytes for Data and Sent, or an error.
+        const char* data; ///< The recieved bytes for Data, valid until ReleaseBuffer is called.
+        int buffer_id; ///< The buffer holding data, to give back with ReleaseBuffer.
+    };
+
+    /**
+     * @class Backend
+     * @brief An interface for waiting on a listener, a wake fd and clients.
+     * @warning Backends are not thread-safe, they should only be used by the thread running the server.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class Backend {
+        public:
+            /**
+             * @brief Destructor to clean up resources.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual ~Backend() {}
+
+            /**
+             * @brief Returns the type of the backend.
+             * @return The type of the backend.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual BackendType get_type() = 0;
+
+            /**
+             * @brief Starts watching a listening socket for clients.
+             * @param fd The fd of the non-blocking listening socket.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void AddListener(int fd) = 0;
+
+            /**
+             * @brief Starts watching an eventfd used to wake the server up.
+             * @param fd The fd of the eventfd.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void AddWake(int fd) = 0;
+
+            /**
+             * @brief Starts watching a client.
+             * @param fd The fd of the non-blocking client socket.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void AddClient(int fd) = 0;
+
+            /**
+             * @brief Stops watching a client before it is closed.
+             * @param fd The fd of the client.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void RemoveClient(int fd) = 0;
+
+            /**
+             * @brief Waits for events.
+             * @param events Cleared and filled with the events that happened.
+             * @param timeout The most milliseconds to wait, -1 to wait forever and 0 to not wait.
+             * @return The number of events.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual int Wait(std::vector<Event>& events, int timeout) = 0;
+
+            /**
+             * @brief Returns if sends are done by the backend with Send instead of by the caller.
+             * @return True if Send should be used.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual bool SendsAsync() = 0;
+
+            /**
+             * @brief Starts sending buffers to a client, finishing with a Sent event.
+             * @param fd The fd of the client.
+             * @param iov The buffers to send, they must stay valid until the Sent event.
+             * @param iovcnt The number of buffers.
+             * @param close_after If the client should be shut down and closed straight after, linked to the send.
+             * @warning Only one send can be in flight for each client. If close_after is set and every byte is sent the backend owns closing the fd.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void Send(int fd, const iovec* iov, int iovcnt, bool close_after) = 0;
+
+            /**
+             * @brief Asks for a Writable event once the client can be written to, after a write hit EAGAIN.
+             * @param fd The fd of the client.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void WatchWritable(int fd) = 0;
+
+            /**
+             * @brief Gives a buffer from a Data event back to the backend.
+             * @param buffer_id The buffer_id of the event.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void ReleaseBuffer(int buffer_id) = 0;
+
+            /**
+             * @brief Stops reading from a client, e.g while it isn't reading the responses it was sent.
+             * @param fd The fd of the client.
+             * @warning Data already being recieved can still be reported after this.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void PauseReading(int fd) = 0;
+
+            /**
+             * @brief Starts reading from a client again after PauseReading.
+             * @param fd The fd of the client.
+             * @author banana584
+             * @date 17/10/26
+             */
+            virtual void ResumeReading(int fd) = 0;
+    };
+
+    /**
+     * @class EpollBackend
+     * @brief A backend using edge-triggered epoll.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class EpollBackend : public Backend {
+        private:
+            int epoll_fd; ///< The epoll instance.
+            int listener_fd; ///< The listening socket.
+            int wake_fd; ///< The wake eventfd.
+            std::vector<epoll_event> events; ///< Space for epoll_wait to fill.
+        public:
+            /**
+             * @brief Constructor.
+             * @param max_events The most events to take from one epoll_wait.
+             * @author banana584
+             * @date 17/10/26
+             */
+            EpollBackend(int max_events = 256);
+
+            /**
+             * @brief Destructor to clean up resources.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~EpollBackend();
+
+            BackendType get_type() override;
+            void AddListener(int fd) override;
+            void AddWake(int fd) override;
+            void AddClient(int fd) override;
+            void RemoveClient(int fd) override;
+            int Wait(std::vector<Event>& events, int timeout) override;
+            bool SendsAsync() override;
+            void Send(int fd, const iovec* iov, int iovcnt, bool close_after) override;
+            void WatchWritable(int fd) override;
+            void ReleaseBuffer(int buffer_id) override;
+            void PauseReading(int fd) override;
+            void ResumeReading(int fd) override;
+    };
+
+    /**
+     * @class IOUringBackend
+     * @brief A backend using io_uring with multishot accept, multishot recv into a provided buffer ring, registered fds and linked send, shutdown and close.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class IOUringBackend : public Backend {
+        private:
+            /**
+             * @struct SendState
+             * @brief The message for a send in flight, kept alive until it completes.
+             */
+            struct SendState {
+                msghdr message; ///< The message given to the kernel.
+                std::vector<iovec> iov; ///< A copy of the buffers in the message.
+            };
+
+            int ring_fd; ///< The io_uring instance.
+            void* sq_ring; ///< The mapped submission ring.
+            size_t sq_ring_size; ///< The size of the submission ring mapping.
+            void* cq_ring; ///< The mapped completion ring, the same as sq_ring with a single mmap.
+            size_t cq_ring_size; ///< The size of the completion ring mapping.
+            io_uring_sqe* sqes; ///< The mapped submission entries.
+            size_t sqes_size; ///< The size of the submission entries mapping.
+            unsigned* sq_head; ///< The kernel's submission head.
+            unsigned* sq_tail; ///< The kernel's submission tail.
+            unsigned sq_mask; ///< The mask for submission indexes.
+            unsigned sq_entries; ///< The number of submission entries.
+            unsigned* sq_array; ///< The submission index array.
+            unsigned sq_local_tail; ///< The submission tail including entries not yet given to the kernel.
+            unsigned* cq_head; ///< The kernel's completion head.
+            unsigned* cq_tail; ///< The kernel's completion tail.
+            unsigned cq_mask; ///< The mask for completion indexes.
+            io_uring_cqe* cqes; ///< The completion entries.
+            io_uring_buf_ring* buffer_ring; ///< The ring of buffers given to the kernel for recv.
+            size_t buffer_ring_size; ///< The size of the buffer ring mapping.
+            char* buffers; ///< The memory behind the buffer ring.
+            unsigned buffer_count; ///< The number of buffers.
+            unsigned buffer_size; ///< The size of each buffer.
+            unsigned short buffer_tail; ///< The tail of the buffer ring.
+            std::vector<int> slots; ///< The fd in every registered file slot, slot i holds fd i.
+            bool fixed_files; ///< If registered files are being used.
+            std::vector<uint32_t> generations; ///< A counter per fd so completions for an old client on a reused fd are dropped.
+            std::vector<bool> paused; ///< If reading from each fd is paused, so a recv that ends isn't rearmed until it is resumed.
+            std::unordered_map<uint64_t, SendState> sends; ///< Sends in flight keyed by user data.
+            int listener_fd; ///< The listening socket.
+            int wake_fd; ///< The wake eventfd.
+        private:
+            /**
+             * @brief Gets a free submission entry, submitting to the kernel first if the ring is full.
+             * @return A zeroed submission entry.
+             */
+            io_uring_sqe* GetSQE();
+
+            /**
+             * @brief Submits every queued entry and optionally waits for completions.
+             * @param wait_nr The number of completions to wait for.
+             * @param timeout The most milliseconds to wait, -1 for no limit.
+             * @return The result of io_uring_enter.
+             */
+            int Submit(unsigned wait_nr, int timeout);
+
+            /**
+             * @brief Queues a multishot accept on the listener.
+             */
+            void ArmAccept();
+
+            /**
+             * @brief Queues a multishot recv on a client.
+             * @param fd The client.
+             */
+            void ArmRecv(int fd);
+
+            /**
+             * @brief Queues a multishot poll on the wake fd.
+             */
+            void ArmWake();
+
+            /**
+             * @brief Returns if a client uses a registered file slot.
+             * @param fd The client.
+             * @return True if fd has a slot.
+             */
+            bool IsFixed(int fd);
+
+            /**
+             * @brief Packs an operation, generation and fd into user data.
+             * @param op The operation.
+             * @param fd The fd.
+             * @return The packed user data.
+             */
+            uint64_t Pack(uint8_t op, int fd);
+        public:
+            /**
+             * @brief Constructor.
+             * @param entries The number of submission entries.
+             * @param buffer_count The number of recv buffers, a power of 2.
+             * @param buffer_size The size of each recv buffer.
+             * @author banana584
+             * @date 17/10/26
+             */
+            IOUringBackend(unsigned entries = 4096, unsigned buffer_count = 1024, unsigned buffer_size = 4096);
+
+            /**
+             * @brief Copying is disabled since the ring is owned.
+             */
+            IOUringBackend(const IOUringBackend& other) = delete;
+
+            /**
+             * @brief Copying is disabled since the ring is owned.
+             */
+            IOUringBackend& operator=(const IOUringBackend& other) = delete;
+
+            /**
+             * @brief Destructor to clean up resources.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~IOUringBackend();
+
+            BackendType get_type() override;
+            void AddListener(int fd) override;
+            void AddWake(int fd) override;
+            void AddClient(int fd) override;
+            void RemoveClient(int fd) override;
+            int Wait(std::vector<Event>& events, int timeout) override;
+            bool SendsAsync() override;
+            void Send(int fd, const iovec* iov, int iovcnt, bool close_after) override;
+            void WatchWritable(int fd) override;
+            void ReleaseBuffer(int buffer_id) override;
+            void PauseReading(int fd) override;
+            void ResumeReading(int fd) override;
+    };
+
+    /**
+     * @brief Creates a backend.
+     * @param type The type of backend wanted.
+     * @return The backend, falling back to epoll if io_uring is not available on this kernel, get_type tells which one it is.
+     * @author banana584
+     * @date 17/10/26
+     */
+    std::unique_ptr<Backend> CreateBackend(BackendType type);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef NETWORKING_SCAN_SCAN_HPP
+#define NETWORKING_SCAN_SCAN_HPP
+
+#include <iostream>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+
+/**
+ * @namespace Scan
+ * @brief This namespace contains vectorized scanning for the delimiters and invalid characters of HTTP requests.
+ * @author banana584
+ * @date 17/10/26
+ */
+namespace Scan {
+    /**
+     * @enum Level
+     * @brief The instruction sets scanning can use.
+     * @author banana584
+     * @date 17/10/26
+     */
+    enum class Level {
+        Scalar, ///< One byte at a time.
+        SSE42, ///< 16 bytes at a time with pcmpestri.
+        AVX2 ///< 32 bytes at a time with nibble lookups and movemask.
+    };
+
+    /**
+     * @class CharClass
+     * @brief A set of bytes, with the tables each level needs to test 16 or 32 bytes at once.
+     * @warning Bytes 0x80 to 0xFF must either all be members or all not be.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class CharClass {
+        private:
+            std::array<bool, 256> members; ///< If each byte is a member.
+        public:
+            std::array<uint8_t, 16> ranges; ///< Low and high bytes of up to 8 ranges covering every non-member, for pcmpestri.
+            int range_length; ///< The number of bytes of ranges used.
+            std::array<uint8_t, 16> low_nibbles; ///< For each low nibble, bit h is set if the byte with high nibble h is a member, for h below 8.
+            bool high_members; ///< If bytes 0x80 to 0xFF are members.
+        public:
+            /**
+             * @brief Constructor.
+             * @param member_ranges The inclusive ranges of bytes that are members.
+             * @author banana584
+             * @date 17/10/26
+             */
+            CharClass(std::initializer_list<std::pair<uint8_t, uint8_t>> member_ranges);
+
+            /**
+             * @brief Returns if a byte is a member.
+             * @param c The byte.
+             * @return True if a member.
+             * @author banana584
+             * @date 17/10/26
+             */
+            bool contains(char c) const { return members[static_cast<uint8_t>(c)]; }
+    };
+
+    /**
+     * @brief Returns the characters allowed in a token, such as a method or header name.
+     * @return The class of token characters.
+     * @author banana584
+     * @date 17/10/26
+     */
+    const CharClass& Token();
+
+    /**
+     * @brief Returns the characters allowed in a header value, which is everything but control characters other than tab.
+     * @return The class of header value characters.
+     * @author banana584
+     * @date 17/10/26
+     */
+    const CharClass& FieldValue();
+
+    /**
+     * @brief Returns the visible ASCII characters, which are what a request target or version can hold.
+     * @return The class of visible characters.
+     * @author banana584
+     * @date 17/10/26
+     */
+    const CharClass& Visible();
+
+    /**
+     * @brief Finds the first byte that isn't in a class.
+     * @param data The bytes to scan.
+     * @param length The number of bytes.
+     * @param members The class of bytes to skip over.
+     * @return The index of the first non-member, or length if every byte is a member.
+     * @author banana584
+     * @date 17/10/26
+     */
+    size_t FindNotIn(const char* data, size_t length, const CharClass& members);
+
+    /**
+     * @brief Returns the best level the CPU supports.
+     * @return The level.
+     * @author banana584
+     * @date 17/10/26
+     */
+    Level get_supported_level();
+
+    /**
+     * @brief Returns the level scanning uses, which starts as the best supported.
+     * @return The level.
+     * @author banana584
+     * @date 17/10/26
+     */
+    Level get_level();
+
+    /**
+     * @brief Changes the level scanning uses, e.g to compare them.
+     * @param level The level wanted, lowered to the best supported if the CPU can't run it.
+     * @return The level now in use.
+     * @warning Not thread-safe, set it before starting any servers.
+     * @author banana584
+     * @date 17/10/26
+     */
+    Level set_level(Level level);
+}
+
+#endif
@@ -4,12 +4,21 @@
 #include <iostream>
 #include <cstring>
 #include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "../buffers/buffers.hpp"
 
 /**
  * @namespace Sockets
@@ -96,6 +105,16 @@ namespace Sockets {
              */
             std::shared_ptr<Socket> Accept();
 
+            /**
+             * @brief Accepts every client waiting in the backlog.
+             * @param accepted A vector the newly accepted clients are added to.
+             * @return The number of clients accepted.
+             * @warning The socket must be non-blocking, clients are accepted until the kernel reports EAGAIN. Accepted clients are non-blocking and close-on-exec, and are not added to clients so the caller can track them however suits it.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t AcceptBatch(std::vector<std::shared_ptr<Socket>>& accepted);
+
             /**
              * @brief Connects to a server.
              * @warning If Bind and/or Listen has been called before this, it will not work since this function is for clients.
@@ -118,6 +137,17 @@ namespace Sockets {
              */
             int Send(Socket& socket, std::string& message);
 
+            /**
+             * @brief Sends several buffers to another socket with one writev, e.g a status line, headers and body without joining them.
+             * @param socket The other socket to send to.
+             * @param iov The buffers to send, in order.
+             * @return 0 for success otherwise an error.
+             * @warning Blocks until every buffer is sent, partial writes are resumed from where they stopped.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int SendV(Socket& socket, std::vector<iovec> iov);
+
             /**
              * @brief Recieves a message from another socket.
              * @param socket The other socket to recieve the message from.
@@ -138,6 +168,96 @@ namespace Sockets {
              */
             std::string RecvInst(Socket& socket);
 
+            /**
+             * @brief Recieves everything currently waiting on a non-blocking socket, up to a limit.
+             * @param socket The other socket to recieve from.
+             * @param buffer The buffer to recieve into, grown from its pool when full.
+             * @param closed Set to true if the other socket has shut down its side of the connection.
+             * @param limit The most bytes to recieve.
+             * @return The number of bytes appended to buffer, 0 if there was nothing waiting.
+             * @warning Reads until the kernel reports EAGAIN so it is safe to use with edge-triggered epoll, unless limit bytes are read first in which case more may be waiting without a new edge. Never blocks even if the socket does.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ssize_t RecvAvailable(Socket& socket, Buffers::RecvBuffer& buffer, bool& closed, size_t limit = SIZE_MAX);
+
+            /**
+             * @brief Sends as much of a message as the socket will take without blocking.
+             * @param socket The other socket to send to.
+             * @param data A pointer to the data to send.
+             * @param length The number of bytes to send.
+             * @return The number of bytes sent, which can be less than length if the send buffer filled up.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ssize_t SendAvailable(Socket& socket, const char* data, size_t length);
+
+            /**
+             * @brief Sends as much of several buffers as the socket will take without blocking.
+             * @param socket The other socket to send to.
+             * @param iov A pointer to the buffers to send, in order.
+             * @param iovcnt The number of buffers.
+             * @param more If more data will follow straight after, so the kernel can hold back a partial packet (MSG_MORE).
+             * @return The number of bytes sent across all the buffers.
+             * @warning iov is not changed, the caller has to skip what was sent before calling again.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ssize_t SendVAvailable(Socket& socket, const iovec* iov, int iovcnt, bool more = false);
+
+            /**
+             * @brief Sends part of a file straight from the page cache to another socket.
+             * @param socket The other socket to send to.
+             * @param file_fd The file to send from.
+             * @param offset Where in the file to start.
+             * @param length The number of bytes to send.
+             * @return 0 for success otherwise an error.
+             * @warning Blocks until everything is sent.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int SendFile(Socket& socket, int file_fd, off_t offset, size_t length);
+
+            /**
+             * @brief Sends as much of part of a file as the socket will take without blocking.
+             * @param socket The other socket to send to.
+             * @param file_fd The file to send from.
+             * @param offset Where in the file to start.
+             * @param length The number of bytes to send.
+             * @return The number of bytes sent.
+             * @note Uses sendfile, falling back to splice through a pipe if the file doesn't support sendfile. Neither path waits for the socket, what it won't take now is left for a later call.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ssize_t SendFileAvailable(Socket& socket, int file_fd, off_t offset, size_t length);
+
+            /**
+             * @brief Puts the socket into non-blocking mode.
+             * @return 0 for success otherwise an error.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int SetNonBlocking();
+
+            /**
+             * @brief Sets SO_REUSEPORT so several sockets can bind and listen on the same address.
+             * @return 0 for success otherwise an error.
+             * @warning Must be called before Bind.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int SetReusePort();
+
+            /**
+             * @brief Attaches a classic BPF program that sends each new connection to the listener matching the CPU it arrived on.
+             * @param group_size The number of listeners sharing the port with SO_REUSEPORT.
+             * @return 0 for success otherwise an error.
+             * @warning Listener i in the group is the i-th one to call Listen, so workers should be pinned to the matching CPU.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int AttachCPUSteering(int group_size);
+
             /**
              * @brief Returns the socket's file descriptor.
              * @return The file descriptor of the socket.
@@ -147,6 +267,15 @@ namespace Sockets {
              */
             int get_fd();
 
+            /**
+             * @brief Gives up ownership of the file descriptor so the destructor won't close it.
+             * @return The file descriptor the socket had.
+             * @warning Use when something else, such as an io_uring close, is closing the fd.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int Release();
+
             /**
              * @brief Returns the socket's address.
              * @return A shared pointer to the address of the socket.
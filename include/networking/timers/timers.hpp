@@ -0,0 +1,181 @@
+#ifndef NETWORKING_TIMERS_TIMERS_HPP
+#define NETWORKING_TIMERS_TIMERS_HPP
+
+#include <iostream>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * @namespace Timers
+ * @brief This namespace contains timers for deadlines that are armed and cancelled far more often than they fire.
+ * @author banana584
+ * @date 17/10/26
+ */
+namespace Timers {
+    class TimingWheel;
+
+    /**
+     * @brief Returns the current time for timers.
+     * @return Milliseconds on the monotonic clock.
+     * @author banana584
+     * @date 17/10/26
+     */
+    uint64_t Now();
+
+    /**
+     * @struct Timer
+     * @brief A deadline that links itself into a TimingWheel slot, so it can be embedded in whatever it times.
+     * @warning A timer must not be moved while it is armed, it cancels itself when destroyed.
+     * @author banana584
+     * @date 17/10/26
+     */
+    struct Timer {
+        Timer* prev = nullptr; ///< The previous timer in the slot, or the slot itself.
+        Timer* next = nullptr; ///< The next timer in the slot, or the slot itself.
+        TimingWheel* wheel = nullptr; ///< The wheel the timer is armed on, null if not armed.
+        uint64_t expires = 0; ///< The tick the timer fires on.
+        int id = -1; ///< What the timer is for, e.g the fd of a connection.
+
+        /**
+         * @brief Constructor.
+         * @param id What the timer is for.
+         * @author banana584
+         * @date 17/10/26
+         */
+        Timer(int id = -1) : id(id) {}
+
+        /**
+         * @brief Copying is disabled since the timer is linked into a slot by address.
+         */
+        Timer(const Timer& other) = delete;
+
+        /**
+         * @brief Copying is disabled since the timer is linked into a slot by address.
+         */
+        Timer& operator=(const Timer& other) = delete;
+
+        /**
+         * @brief Destructor that cancels the timer.
+         * @author banana584
+         * @date 17/10/26
+         */
+        ~Timer();
+
+        /**
+         * @brief Returns if the timer is armed.
+         * @return True if armed.
+         * @author banana584
+         * @date 17/10/26
+         */
+        bool armed() const { return wheel != nullptr; }
+
+        /**
+         * @brief Unlinks the timer from its slot if it is armed.
+         * @author banana584
+         * @date 17/10/26
+         */
+        void Cancel();
+    };
+
+    /**
+     * @class TimingWheel
+     * @brief A hierarchical timing wheel with 4 levels of 64 slots, timers in higher levels cascade down as their tick comes closer.
+     * @warning Not thread-safe, each server keeps its own wheel.
+     * @author banana584
+     * @date 17/10/26
+     */
+    class TimingWheel {
+        private:
+            static constexpr int LEVELS = 4; ///< The number of levels.
+            static constexpr int SLOT_BITS = 6; ///< The bits of a tick each level covers.
+            static constexpr int SLOTS = 1 << SLOT_BITS; ///< The number of slots per level.
+
+            uint64_t tick_ms; ///< The milliseconds in one tick.
+            uint64_t current; ///< The last tick that was processed.
+            size_t count; ///< The number of armed timers.
+            std::vector<Timer> slots; ///< The head of every slot's list, level by level.
+
+            friend struct Timer;
+        private:
+            /**
+             * @brief Links a timer into the slot for its tick.
+             * @param timer The timer, already unlinked.
+             */
+            void Place(Timer& timer);
+
+            /**
+             * @brief Returns the head of a slot.
+             * @param level The level.
+             * @param slot The slot in the level.
+             * @return The head of the slot's list.
+             */
+            Timer& Slot(int level, int slot) { return slots[level * SLOTS + slot]; }
+        public:
+            /**
+             * @brief Constructor.
+             * @param tick_ms The milliseconds in one tick, which is how precise deadlines are.
+             * @param now The current time in milliseconds from Now.
+             * @author banana584
+             * @date 17/10/26
+             */
+            TimingWheel(uint64_t tick_ms = 10, uint64_t now = Now());
+
+            /**
+             * @brief Copying is disabled since timers point into the slots.
+             */
+            TimingWheel(const TimingWheel& other) = delete;
+
+            /**
+             * @brief Copying is disabled since timers point into the slots.
+             */
+            TimingWheel& operator=(const TimingWheel& other) = delete;
+
+            /**
+             * @brief Destructor that cancels every armed timer.
+             * @author banana584
+             * @date 17/10/26
+             */
+            ~TimingWheel();
+
+            /**
+             * @brief Arms a timer, moving it if it was already armed.
+             * @param timer The timer to arm.
+             * @param deadline When the timer should fire in milliseconds from Now.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Arm(Timer& timer, uint64_t deadline);
+
+            /**
+             * @brief Moves time forward and collects every timer that has fired.
+             * @param now The current time in milliseconds from Now.
+             * @param expired Filled with the timers that fired, which are no longer armed.
+             * @author banana584
+             * @date 17/10/26
+             */
+            void Advance(uint64_t now, std::vector<Timer*>& expired);
+
+            /**
+             * @brief Returns how long until Advance should next be called.
+             * @param now The current time in milliseconds from Now.
+             * @return Milliseconds to wait, or -1 if no timer is armed.
+             * @warning Timers in higher levels only report when they next cascade, so this can be earlier than the next deadline.
+             * @author banana584
+             * @date 17/10/26
+             */
+            int NextTimeout(uint64_t now);
+
+            /**
+             * @brief Returns the number of armed timers.
+             * @return The number of timers.
+             * @author banana584
+             * @date 17/10/26
+             */
+            size_t size();
+    };
+}
+
+#endif
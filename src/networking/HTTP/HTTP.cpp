@@ -29,94 +29,710 @@ HTTP::Requests::HTTPRequest::HTTPRequest(std::string method, std::string url, st
     this->body = body;
 }
 
-static std::vector<std::string> split(const std::string& s, char delim) {
+static std::vector<std::string> split(std::string_view s, char delim) {
     // Setup variables.
     std::vector<std::string> result;
-    std::istringstream ss(s);
-    std::string item;
+    size_t start = 0;
 
-    // Loop over every line and split by delim (handled by std::getline)
-    while (std::getline(ss, item, delim)) {
+    // Loop over every delim, a trailing one doesn't add an empty item.
+    while (start < s.size()) {
+        size_t end = s.find(delim, start);
+        if (end == std::string_view::npos) {
+            end = s.size();
+        }
         // Add to results.
-        result.push_back(item);
+        result.emplace_back(s.substr(start, end - start));
+        start = end + 1;
     }
 
     return result;
 }
 
-HTTP::Requests::HTTPRequest::HTTPRequest(std::string raw) {
-    // Check for an empty string.
-    if (raw.empty()) {
-        // Throw an error if invalid.
-        throw std::invalid_argument("Invalid HTTP request");
+static std::string_view trim(std::string_view str) {
+    // Strip spaces and tabs from both ends.
+    size_t start = str.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return str.substr(str.size());
     }
+    size_t end = str.find_last_not_of(" \t");
+    return str.substr(start, end - start + 1);
+}
 
-    // Setup variables for parsing.
-    std::istringstream request_stream(raw);
-    std::string request_line;
-    std::getline(request_stream, request_line);
+HTTP::Requests::HeaderMap::HeaderMap() : known(), present(0), overflow() {}
 
-    // Check if the line is empty
-    if (request_line.empty()) {
-        // Throw an error if invalid.
-        throw std::invalid_argument("Invalid HTTP request");
+HTTP::Requests::HeaderMap::HeaderMap(const std::map<std::string, std::string>& headers) : HeaderMap() {
+    // Add each header.
+    for (const std::pair<const std::string, std::string>& pair : headers) {
+        Add(pair.first, pair.second);
     }
+}
 
-    // Split line by space.
-    std::vector<std::string> parts = split(request_line, ' ');
-    if (parts.size() != 3) {
-        // Throw an error if invalid.
-        throw std::invalid_argument("Invalid HTTP request");
+const std::string* HTTP::Requests::HeaderMap::find(std::string_view name) const {
+    // Known headers are in their slot.
+    HTTP::Requests::KnownHeader header = HTTP::Requests::FindKnownHeader(name);
+    if (header != HTTP::Requests::KnownHeader::Count) {
+        return get(header);
+    }
+
+    // Check every other header in order so the first one wins.
+    for (const std::pair<std::string, std::string>& pair : overflow) {
+        if (HTTP::Requests::EqualsIgnoreCase(pair.first, name)) {
+            return &pair.second;
+        }
+    }
+    return nullptr;
+}
+
+void HTTP::Requests::HeaderMap::Add(std::string_view name, std::string_view value) {
+    // Use the slot of a known header unless it is already taken.
+    HTTP::Requests::KnownHeader header = HTTP::Requests::FindKnownHeader(name);
+    size_t index = static_cast<size_t>(header);
+    if (header != HTTP::Requests::KnownHeader::Count && !((present >> index) & 1)) {
+        known[index].assign(value.data(), value.size());
+        present |= 1ULL << index;
+        return;
+    }
+    overflow.emplace_back(std::string(name), std::string(value));
+}
+
+void HTTP::Requests::HeaderMap::Set(std::string_view name, std::string_view value) {
+    // Replace whatever was there.
+    Remove(name);
+    Add(name, value);
+}
+
+bool HTTP::Requests::HeaderMap::Remove(std::string_view name) {
+    // Clear the slot of a known header.
+    bool removed = false;
+    HTTP::Requests::KnownHeader header = HTTP::Requests::FindKnownHeader(name);
+    if (header != HTTP::Requests::KnownHeader::Count) {
+        size_t index = static_cast<size_t>(header);
+        removed = (present >> index) & 1;
+        present &= ~(1ULL << index);
+        known[index].clear();
+    }
+
+    // Drop any in the list.
+    size_t before = overflow.size();
+    overflow.erase(std::remove_if(overflow.begin(), overflow.end(), [name](const std::pair<std::string, std::string>& pair) { return HTTP::Requests::EqualsIgnoreCase(pair.first, name); }), overflow.end());
+    return removed || overflow.size() != before;
+}
+
+size_t HTTP::Requests::HeaderMap::size() const {
+    return __builtin_popcountll(present) + overflow.size();
+}
+
+std::vector<std::pair<std::string_view, std::string_view>> HTTP::Requests::HeaderMap::list() const {
+    // Known headers first, then the rest in order.
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+    headers.reserve(size());
+    for (size_t i = 0; i < HTTP::Requests::KNOWN_HEADER_COUNT; i++) {
+        if ((present >> i) & 1) {
+            headers.emplace_back(HTTP::Requests::KNOWN_HEADER_NAMES[i], known[i]);
+        }
+    }
+    for (const std::pair<std::string, std::string>& pair : overflow) {
+        headers.emplace_back(pair.first, pair.second);
+    }
+    return headers;
+}
+
+std::string_view HTTP::Requests::RequestView::find_header(std::string_view name) const {
+    // Known headers are in their slot.
+    HTTP::Requests::KnownHeader header = HTTP::Requests::FindKnownHeader(name);
+    if (header != HTTP::Requests::KnownHeader::Count) {
+        return get_header(header);
+    }
+
+    // Check every other header in order so the first one wins.
+    for (size_t i = 0; i < header_count; i++) {
+        if (HTTP::Requests::EqualsIgnoreCase(headers[i].name, name)) {
+            return headers[i].value;
+        }
+    }
+    return std::string_view();
+}
+
+HTTP::Requests::RequestParser::RequestParser() {
+    Reset();
+}
+
+void HTTP::Requests::RequestParser::Reset() {
+    // Start again at the method.
+    this->stage = Stage::Method;
+    this->position = 0;
+    this->mark = 0;
+    this->header_count = 0;
+    this->seen = 0;
+}
+
+bool HTTP::Requests::RequestParser::SkipLineEnd(std::string_view raw) {
+    // Lines end with CRLF, or a bare LF from lenient clients.
+    if (raw[position] == '\n') {
+        position++;
+        return true;
+    }
+    if (raw[position] == '\r') {
+        if (position + 1 == raw.size()) {
+            return false;
+        }
+        if (raw[position + 1] == '\n') {
+            position += 2;
+            return true;
+        }
+    }
+
+    // Anything else is a character that isn't allowed.
+    throw std::invalid_argument("Invalid character in HTTP request");
+}
+
+size_t HTTP::Requests::RequestParser::Parse(std::string_view raw, HTTP::Requests::RequestView& request) {
+    const char* data = raw.data();
+    size_t length = raw.size();
+
+    // Carry on from where the last call stopped.
+    while (stage != Stage::Done) {
+        if (position >= length) {
+            return 0;
+        }
+        switch (stage) {
+            case Stage::Method:
+                // The method is a token ended by a space.
+                position += Scan::FindNotIn(data + position, length - position, Scan::Token());
+                if (position == length) {
+                    return 0;
+                }
+                if (position == mark || data[position] != ' ') {
+                    throw std::invalid_argument("Invalid HTTP request");
+                }
+                method = Span{mark, position - mark};
+                mark = ++position;
+                stage = Stage::Target;
+                break;
+            case Stage::Target:
+                // The target is visible characters ended by a space.
+                position += Scan::FindNotIn(data + position, length - position, Scan::Visible());
+                if (position == length) {
+                    return 0;
+                }
+                if (position == mark || data[position] != ' ') {
+                    throw std::invalid_argument("Invalid HTTP request");
+                }
+                target = Span{mark, position - mark};
+                mark = ++position;
+                stage = Stage::Version;
+                break;
+            case Stage::Version:
+                // The version is visible characters ended by the line.
+                position += Scan::FindNotIn(data + position, length - position, Scan::Visible());
+                if (position == length) {
+                    return 0;
+                }
+                if (position == mark) {
+                    throw std::invalid_argument("Invalid HTTP request");
+                }
+                version = Span{mark, position - mark};
+                stage = Stage::LineEnd;
+                break;
+            case Stage::LineEnd:
+                // Step onto the next line.
+                if (!SkipLineEnd(raw)) {
+                    return 0;
+                }
+                mark = position;
+                stage = Stage::HeaderStart;
+                break;
+            case Stage::HeaderStart:
+                // A blank line ends the headers, anything else starts a header.
+                stage = data[position] == '\r' || data[position] == '\n' ? Stage::BlankLine : Stage::HeaderName;
+                break;
+            case Stage::HeaderName:
+                // The name is a token ended by a colon.
+                position += Scan::FindNotIn(data + position, length - position, Scan::Token());
+                if (position == length) {
+                    return 0;
+                }
+                if (position == mark || data[position] != ':') {
+                    throw std::invalid_argument("Invalid header in HTTP request");
+                }
+                if (header_count == HTTP::Requests::RequestView::MAX_HEADERS) {
+                    throw std::invalid_argument("Too many headers in HTTP request");
+                }
+                headers[header_count].name = Span{mark, position - mark};
+                headers[header_count].header = HTTP::Requests::FindKnownHeader(raw.substr(mark, position - mark));
+
+                // Repeats of the headers that frame the request could be read differently by a proxy, so they aren't allowed.
+                if (headers[header_count].header != HTTP::Requests::KnownHeader::Count) {
+                    uint64_t bit = 1ULL << static_cast<size_t>(headers[header_count].header);
+                    if ((seen & bit) && (headers[header_count].header == HTTP::Requests::KnownHeader::Host || headers[header_count].header == HTTP::Requests::KnownHeader::ContentLength || headers[header_count].header == HTTP::Requests::KnownHeader::TransferEncoding)) {
+                        throw std::invalid_argument("Repeated header in HTTP request");
+                    }
+                    seen |= bit;
+                }
+                mark = ++position;
+                stage = Stage::HeaderValue;
+                break;
+            case Stage::HeaderValue:
+                // The value runs to the end of the line.
+                position += Scan::FindNotIn(data + position, length - position, Scan::FieldValue());
+                if (position == length) {
+                    return 0;
+                }
+                headers[header_count++].value = Span{mark, position - mark};
+                stage = Stage::LineEnd;
+                break;
+            case Stage::BlankLine:
+                // Step over the blank line and stop.
+                if (!SkipLineEnd(raw)) {
+                    return 0;
+                }
+                stage = Stage::Done;
+                break;
+            case Stage::Done:
+                break;
+        }
+    }
+
+    // Point the view at everything parsed.
+    request.method = raw.substr(method.start, method.length);
+    request.target = raw.substr(target.start, target.length);
+    request.version = raw.substr(version.start, version.length);
+    request.path = std::string_view();
+    request.query = std::string_view();
+    request.known.fill(HTTP::Requests::HeaderView());
+    request.header_count = 0;
+    for (size_t i = 0; i < header_count; i++) {
+        // Put the first of each known header in its slot and everything else in the list.
+        HTTP::Requests::HeaderView field = {raw.substr(headers[i].name.start, headers[i].name.length), trim(raw.substr(headers[i].value.start, headers[i].value.length))};
+        if (headers[i].header != HTTP::Requests::KnownHeader::Count && request.known[static_cast<size_t>(headers[i].header)].value.data() == nullptr) {
+            request.known[static_cast<size_t>(headers[i].header)] = field;
+        } else {
+            request.headers[request.header_count++] = field;
+        }
+    }
+    request.header_length = position;
+    return position;
+}
+
+size_t HTTP::Requests::ParseRequest(std::string_view raw, HTTP::Requests::RequestView& request) {
+    // Parse in one go.
+    HTTP::Requests::RequestParser parser;
+    request.header_count = 0;
+    request.header_length = 0;
+    return parser.Parse(raw, request);
+}
+
+static int hex_value(char c) {
+    // Map a hex digit to its value, or -1 if it isn't one.
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+std::string_view HTTP::Requests::NormalizeTarget(std::string_view target, char* out, std::string_view& query) {
+    const char* data = target.data();
+    size_t length = target.size();
+    size_t read = 0;
+    query = std::string_view();
+
+    // The asterisk-form only names the server itself.
+    if (target == "*") {
+        out[0] = '*';
+        return std::string_view(out, 1);
+    }
+
+    // Absolute-form carries the scheme and host, which the Host header already gives.
+    if (HTTP::Requests::EqualsIgnoreCase(target.substr(0, 7), "http://") || HTTP::Requests::EqualsIgnoreCase(target.substr(0, 8), "https://")) {
+        read = target.find("//") + 2;
+        while (read < length && data[read] != '/' && data[read] != '?' && data[read] != '#') {
+            read++;
+        }
+    } else if (length == 0 || data[0] != '/') {
+        throw std::invalid_argument("Invalid target in HTTP request");
+    }
+
+    // The path ends at the query or fragment, the query is kept as sent and the fragment dropped.
+    size_t end = read;
+    while (end < length && data[end] != '?' && data[end] != '#') {
+        end++;
+    }
+    if (end < length && data[end] == '?') {
+        size_t fragment = target.find('#', end);
+        query = target.substr(end + 1, (fragment == std::string_view::npos ? length : fragment) - end - 1);
+    }
+
+    // Write each segment after a single /, out never passes read so out can be the target itself.
+    size_t written = 0;
+    out[written++] = '/';
+    while (read < end) {
+        // Collapse repeated slashes.
+        while (read < end && data[read] == '/') {
+            read++;
+        }
+        if (read == end) {
+            break;
+        }
+
+        // Decode the segment.
+        size_t segment = written;
+        while (read < end && data[read] != '/') {
+            char c = data[read++];
+            if (c == '%') {
+                int high = read + 1 < end ? hex_value(data[read]) : -1;
+                int low = high >= 0 ? hex_value(data[read + 1]) : -1;
+                if (low < 0) {
+                    throw std::invalid_argument("Invalid escape in HTTP request target");
+                }
+                c = static_cast<char>(high * 16 + low);
+                read += 2;
+
+                // A decoded separator or control character would let a segment mean something else on disk.
+                if (c == '/' || c == '\\' || static_cast<unsigned char>(c) < 0x20 || c == 0x7F) {
+                    throw std::invalid_argument("Invalid escape in HTTP request target");
+                }
+            }
+            out[written++] = c;
+        }
+
+        // Resolve dot segments, including escaped ones, against what was written so far.
+        std::string_view name(out + segment, written - segment);
+        if (name == ".") {
+            written = segment;
+        } else if (name == "..") {
+            if (segment == 1) {
+                throw std::invalid_argument("HTTP request target leaves the root");
+            }
+            written = segment - 1;
+            while (out[written - 1] != '/') {
+                written--;
+            }
+        } else if (read < end) {
+            // Only write the / over one that was read, so the query after the path is never touched.
+            out[written++] = '/';
+        }
+    }
+
+    // Drop the trailing / so equivalent urls route the same.
+    if (written > 1 && out[written - 1] == '/') {
+        written--;
+    }
+    return std::string_view(out, written);
+}
+
+void HTTP::Requests::NormalizeTarget(char* buffer, HTTP::Requests::RequestView& request) {
+    // The request starts at its method, so the target's offset from it is its offset into buffer.
+    char* out = buffer + (request.target.data() - request.method.data());
+    request.path = HTTP::Requests::NormalizeTarget(request.target, out, request.query);
+}
+
+HTTP::Requests::BodyDecoder::BodyDecoder() {
+    Reset(0);
+}
+
+void HTTP::Requests::BodyDecoder::Reset(size_t content_length) {
+    // A fixed length body is all data.
+    this->chunked = false;
+    this->stage = content_length == 0 ? Stage::Done : Stage::Data;
+    this->remaining = content_length;
+    this->decoded = 0;
+    this->size_digits = false;
+    this->trailer_size = 0;
+    this->line_length = 0;
+}
+
+void HTTP::Requests::BodyDecoder::ResetChunked() {
+    // A chunked body starts with the size of the first chunk.
+    Reset(0);
+    this->chunked = true;
+    this->stage = Stage::ChunkSize;
+}
+
+size_t HTTP::Requests::BodyDecoder::Decode(std::string_view input, std::string_view& chunk) {
+    chunk = std::string_view();
+
+    // Step through framing a byte at a time, stopping at the first run of data.
+    size_t position = 0;
+    while (position < input.size() && stage != Stage::Done) {
+        char c = input[position];
+        switch (stage) {
+            case Stage::Data: {
+                // Hand out as much of the data as has arrived.
+                size_t take = std::min(remaining, input.size() - position);
+                chunk = input.substr(position, take);
+                remaining -= take;
+                decoded += take;
+                if (remaining == 0) {
+                    stage = chunked ? Stage::ChunkDataEnd : Stage::Done;
+                }
+                return position + take;
+            }
+            case Stage::ChunkSize: {
+                // Read hex digits until the extensions or line end.
+                int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if (digit >= 0) {
+                    if (remaining > (SIZE_MAX >> 4)) {
+                        throw std::invalid_argument("Chunk size too large");
+                    }
+                    remaining = (remaining << 4) | digit;
+                    size_digits = true;
+                } else if (!size_digits) {
+                    throw std::invalid_argument("Invalid chunk size");
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    stage = Stage::ChunkExtension;
+                } else if (c == '\r') {
+                    stage = Stage::ChunkSizeEnd;
+                } else if (c == '\n') {
+                    stage = remaining == 0 ? Stage::Trailer : Stage::Data;
+                } else {
+                    throw std::invalid_argument("Invalid chunk size");
+                }
+                break;
+            }
+            case Stage::ChunkExtension:
+                // Extensions are ignored up to the line end.
+                if (c == '\r') {
+                    stage = Stage::ChunkSizeEnd;
+                } else if (c == '\n') {
+                    stage = remaining == 0 ? Stage::Trailer : Stage::Data;
+                }
+                break;
+            case Stage::ChunkSizeEnd:
+                if (c != '\n') {
+                    throw std::invalid_argument("Invalid chunk size line");
+                }
+                stage = remaining == 0 ? Stage::Trailer : Stage::Data;
+                break;
+            case Stage::ChunkDataEnd:
+                // Data is followed by a line end before the next size.
+                if (c == '\r') {
+                    stage = Stage::ChunkDataEndLF;
+                    break;
+                }
+                // Fall through to accept a bare LF.
+                [[fallthrough]];
+            case Stage::ChunkDataEndLF:
+                if (c != '\n') {
+                    throw std::invalid_argument("Missing line end after chunk");
+                }
+                stage = Stage::ChunkSize;
+                size_digits = false;
+                break;
+            case Stage::Trailer:
+                // Trailers are ignored up to the blank line.
+                if (++trailer_size > MAX_TRAILER_SIZE) {
+                    throw std::invalid_argument("Chunked trailers too large");
+                }
+                if (c == '\n') {
+                    if (line_length == 0) {
+                        stage = Stage::Done;
+                    }
+                    line_length = 0;
+                } else if (c != '\r') {
+                    line_length++;
+                }
+                break;
+            case Stage::Done:
+                break;
+        }
+        position++;
     }
 
-    // Set method to first, url to second.
-    this->method = parts[0];
-    this->url = parts[1];
-    // Intialize headers as empty.
-    this->headers = std::map<std::string, std::string>();
+    return position;
+}
+
+bool HTTP::Requests::StartBody(const HTTP::Requests::RequestView& request, HTTP::Requests::BodyDecoder& decoder) {
+    std::string_view transfer_encoding = request.get_header(HTTP::Requests::KnownHeader::TransferEncoding);
+    std::string_view content_length = request.get_header(HTTP::Requests::KnownHeader::ContentLength);
+
+    // A transfer-encoding replaces Content-Length, sending both could be used to desync a proxy so it is rejected.
+    if (!transfer_encoding.empty()) {
+        if (!content_length.empty()) {
+            throw std::invalid_argument("Both Transfer-Encoding and Content-Length in HTTP request");
+        }
+        if (!HTTP::Requests::EqualsIgnoreCase(transfer_encoding, "chunked")) {
+            return false;
+        }
+        decoder.ResetChunked();
+        return true;
+    }
+
+    // Read the digits, rejecting anything else so a bad length can't desync the stream.
+    size_t length = 0;
+    for (char c : content_length) {
+        if (c < '0' || c > '9' || length > (SIZE_MAX - 9) / 10) {
+            throw std::invalid_argument("Invalid Content-Length in HTTP request");
+        }
+        length = length * 10 + (c - '0');
+    }
+    decoder.Reset(length);
+    return true;
+}
+
+HTTP::Requests::RequestBody::RequestBody(size_t spill_threshold, std::string temp_directory) : memory(), fd(-1), length(0), spill_threshold(spill_threshold), temp_directory(temp_directory) {}
 
-    // Loop over all headers.
-    std::string header_line;
-    while (std::getline(request_stream, header_line)) {
-        // Split line by colon.
-        std::vector<std::string> header = split(header_line, ':');
-        // Check if split worked correctly.
-        if (header.size() < 2) {
+HTTP::Requests::RequestBody::~RequestBody() {
+    // Close the temp file, it was unlinked when made so this frees it.
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void write_all(int fd, const char* data, size_t size) {
+    // Keep writing until everything is in the file.
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
             continue;
         }
-        if (header.at(0).empty() || header.at(1).empty()) {
+        if (written <= 0) {
+            throw std::runtime_error("Failed to write request body to temp file");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void HTTP::Requests::RequestBody::Append(std::string_view chunk) {
+    // Move to a temp file once the body would pass the threshold.
+    if (fd < 0 && length + chunk.size() > spill_threshold) {
+        std::string path = temp_directory + "/http-body-XXXXXX";
+        fd = mkostemp(&path[0], O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to make temp file for request body");
+        }
+        unlink(path.c_str());
+        write_all(fd, memory.data(), memory.size());
+        std::string().swap(memory);
+    }
+
+    // Add the chunk to wherever the body is.
+    if (fd >= 0) {
+        write_all(fd, chunk.data(), chunk.size());
+    } else {
+        memory.append(chunk.data(), chunk.size());
+    }
+    length += chunk.size();
+}
+
+size_t HTTP::Requests::RequestBody::Read(size_t offset, char* buffer, size_t size) {
+    // Nothing left past the end.
+    if (offset >= length) {
+        return 0;
+    }
+    size = std::min(size, length - offset);
+
+    // Copy from memory, or read from the file with positioned reads so the offset isn't shared.
+    if (fd < 0) {
+        memcpy(buffer, memory.data() + offset, size);
+        return size;
+    }
+    while (true) {
+        ssize_t bytes_read = pread(fd, buffer, size, offset);
+        if (bytes_read < 0 && errno == EINTR) {
             continue;
         }
+        if (bytes_read < 0) {
+            throw std::runtime_error("Failed to read request body from temp file");
+        }
+        return bytes_read;
+    }
+}
 
-        // Extract name and value from line.
-        std::string header_name = header.at(0);
-        std::string header_value = "";
-        for (size_t i = 1; i < header.size(); i++) {
-            header_value += header.at(i).substr(header.at(i).find_first_not_of(" \t"));
-            if (i != (header.size() - 1)) {
-                header_value += ":";
-            }
+std::string HTTP::Requests::RequestBody::read_all() {
+    // Read the body a chunk at a time.
+    std::string contents(length, '\0');
+    size_t total = 0;
+    while (total < length) {
+        size_t bytes_read = Read(total, &contents[total], length - total);
+        if (bytes_read == 0) {
+            throw std::runtime_error("Request body ended early");
         }
+        total += bytes_read;
+    }
 
-        // Remove whitespace.
-        header_value = header_value.substr(0, header_value.find_last_not_of(' ')) + header_value.substr(header_value.find_last_not_of(' ') + 1);
+    return contents;
+}
 
-        // Insert into hashmap.
-        this->headers.insert(std::make_pair(header_name, header_value));
+HTTP::Requests::HTTPRequest::HTTPRequest(std::string raw) {
+    // Check for an empty string.
+    if (raw.empty()) {
+        // Throw an error if invalid.
+        throw std::invalid_argument("Invalid HTTP request");
     }
 
-    // If url is empty, replace with a /
-    if (this->url.empty()) {
-        this->url = "/";
+    // Parse the request line and headers.
+    HTTP::Requests::RequestView view;
+    size_t header_length = HTTP::Requests::ParseRequest(raw, view);
+    if (header_length == 0) {
+        // Treat the end of the string as the end of the headers, since it may have been read without the blank line.
+        raw += raw.back() == '\n' ? "\r\n" : "\r\n\r\n";
+        header_length = HTTP::Requests::ParseRequest(raw, view);
+        if (header_length == 0) {
+            throw std::invalid_argument("Invalid HTTP request");
+        }
     }
 
-    // Update url to contain host.
-    this->url = headers["Host"] + this->url;
+    // Copy everything out of the view.
+    *this = HTTP::Requests::HTTPRequest(view, std::string_view());
 
-    // Extract body.
-    std::string body;
-    std::getline(request_stream, body);
-    this->body = body;
+    // Decode whatever of the body is in the string.
+    HTTP::Requests::BodyDecoder decoder;
+    if (!HTTP::Requests::StartBody(view, decoder)) {
+        throw std::invalid_argument("Unsupported Transfer-Encoding in HTTP request");
+    }
+    std::string_view rest = std::string_view(raw).substr(std::min(header_length, raw.size()));
+    while (!decoder.done()) {
+        std::string_view chunk;
+        size_t consumed = decoder.Decode(rest, chunk);
+        if (consumed == 0) {
+            break;
+        }
+        this->body.append(chunk.data(), chunk.size());
+        rest.remove_prefix(consumed);
+    }
+}
+
+HTTP::Requests::HTTPRequest::HTTPRequest(const HTTP::Requests::RequestView& view, std::string_view body) {
+    // Set method.
+    this->method = std::string(view.method);
+
+    // Set url to the host followed by the normalized path.
+    std::string_view host = view.get_header(HTTP::Requests::KnownHeader::Host);
+    if (view.path.data() != nullptr) {
+        // Already normalized in the buffer.
+        this->url.reserve(host.size() + view.path.size());
+        this->url.append(host).append(view.path);
+        this->query = std::string(view.query);
+    } else {
+        // Normalize straight into the url.
+        std::string_view target = view.target.empty() ? std::string_view("/") : view.target;
+        std::string_view query;
+        this->url.resize(host.size() + target.size());
+        host.copy(&this->url[0], host.size());
+        std::string_view path = HTTP::Requests::NormalizeTarget(target, &this->url[host.size()], query);
+        this->url.resize(host.size() + path.size());
+        this->query = std::string(query);
+    }
+
+    // Copy every header, known ones straight into their slots.
+    for (size_t i = 0; i < HTTP::Requests::KNOWN_HEADER_COUNT; i++) {
+        if (view.known[i].value.data() != nullptr) {
+            this->headers.Add(view.known[i].name, view.known[i].value);
+        }
+    }
+    for (size_t i = 0; i < view.header_count; i++) {
+        this->headers.Add(view.headers[i].name, view.headers[i].value);
+    }
+
+    // Copy body.
+    this->body = std::string(body);
 }
 
 HTTP::Requests::HTTPRequest::~HTTPRequest() {
@@ -145,11 +761,15 @@ std::string HTTP::Requests::HTTPRequest::toString() {
             raw += host_and_route.at(i);
         }
     }
+    if (!query.empty()) {
+        raw += '?';
+        raw += query;
+    }
     // Add HTTP version.
     raw += " HTTP/1.1\r\n";
 
     // Add headers.
-    for (std::pair<std::string,std::string> pair : headers) {
+    for (const std::pair<std::string_view, std::string_view>& pair : headers.list()) {
         raw += pair.first;
         raw += ": ";
         raw += pair.second;
@@ -170,8 +790,11 @@ HTTP::Responses::HTTPResponse::HTTPResponse(int status, std::map<std::string, st
 }
 
 HTTP::Responses::HTTPResponse::HTTPResponse(std::string raw) {
-    // TODO: Implement HTTP response parsing.
-    return;
+    // Parse the whole response, a body without framing runs to the end of raw.
+    this->status = 0;
+    HTTP::Responses::ResponseParser parser;
+    parser.Parse(raw, *this);
+    parser.Finish();
 }
 
 HTTP::Responses::HTTPResponse::~HTTPResponse() {
@@ -179,98 +802,420 @@ HTTP::Responses::HTTPResponse::~HTTPResponse() {
 }
 
 std::string HTTP::Responses::get_status_string(Status status) {
-    // Use a static hashmap to be more memory efficient.
-    static std::map<HTTP::Responses::Status, std::string> statusStrings = {
-        {Status::OK, "OK"},
-        {Status::BadRequest, "Bad Request"},
-        {Status::Unauthorized, "Unauthorized"},
-        {Status::Forbidden, "Forbidden"},
-        {Status::NotFound, "Not Found"},
-        {Status::InternalServerError, "Internal Server Error"},
-        {Status::BadGateway, "Bad Gateway"}
-    };
-
-    // Iterate to find status code.
-    auto it = statusStrings.find(status);
-    if (it != statusStrings.end()) {
-        return it->second;
+    // Look the reason up in the table built at compile time.
+    const HTTP::Responses::StatusInfo* info = HTTP::Responses::FindStatus(static_cast<int>(status));
+    if (info) {
+        return std::string(info->reason);
     }
 
     // Return a default status string if the status is not found in the mapping table.
     return "Unknown Status";
 }
 
-std::string HTTP::Responses::HTTPResponse::toString() {
-    // Setup variable for raw string.
-    std::string raw = "HTTP/1.1 ";
-
-    // Add status and status string.
-    raw += std::to_string(status);
-    raw += " ";
-    raw += get_status_string((HTTP::Responses::Status)status);
-    raw += "\r\n";
+std::string_view HTTP::Responses::get_date() {
+    thread_local time_t cached_second = -1;
+    thread_local char cached[30];
 
-    // Add headers.
-    for (std::pair<std::string,std::string> pair : headers) {
-        raw += pair.first;
-        raw += ": ";
-        raw += pair.second;
-        raw += "\r\n";
+    // Only reformat when the second has changed.
+    time_t now = time(nullptr);
+    if (now != cached_second) {
+        Cache::FormatDate(now, cached);
+        cached_second = now;
     }
 
-    // Add body.
-    raw += "\r\n";
-    raw += body;
-
-    return raw;
+    return std::string_view(cached, 29);
 }
 
-// Copies data into struct.
-HTTP::Responses::Node::Node(const HTTP::Responses::Node& parent, NodeType type, std::string url_part, std::string file_path) : parent(std::make_shared<HTTP::Responses::Node>(parent)), children(std::vector<std::shared_ptr<Node>>()), type(type), url_part(url_part), file_path(file_path) {}
-
-// Copies data into struct.
-HTTP::Responses::Node::Node(std::shared_ptr<HTTP::Responses::Node> parent, NodeType type, std::string url_part, std::string file_path) : parent(parent), children(std::vector<std::shared_ptr<Node>>()), type(type), url_part(url_part), file_path(file_path) {}
+HTTP::Responses::FileBody::FileBody(const std::string& path) {
+    // Open file.
+    this->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
 
-// Copies data into struct.
-HTTP::Responses::Node::Node(const HTTP::Responses::Node& other) : parent(other.parent), children(std::vector<std::shared_ptr<Node>>()), type(other.type), url_part(other.url_part), file_path(other.file_path) {
-    // Loop over other's children and copy to here;
-    for (const auto& child : other.children) {
-        children.push_back(std::make_shared<Node>(*child));
+    // Get the size of the file.
+    struct stat info;
+    if (fstat(this->fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        close(this->fd);
+        throw std::runtime_error("Failed to stat " + path);
     }
+    this->length = info.st_size;
+
+    // Describe the version being sent for conditional requests.
+    this->etag = Cache::EntityTag(info, "");
+    this->modified = info.st_mtim.tv_sec;
 }
 
-HTTP::Responses::Node::Node() {
-    // Initialize all to empty values.
-    this->parent = nullptr;
-    this->children = std::vector<std::shared_ptr<Node>>();
-    this->type = NAME;
-    this->url_part = std::string();
-    this->file_path = std::string();
+HTTP::Responses::FileBody::~FileBody() {
+    // Close file.
+    close(fd);
 }
 
-HTTP::Responses::Node& HTTP::Responses::Node::operator=(const HTTP::Responses::Node& other) {
-    // Sanity check for copy one variable into itself.
-    if (this == &other) {
-        return *this;
-    }
-    // Check for other parent and if so copy it.
-    if (other.parent) {
-        this->parent = other.parent;
-    }
-    // Copy children into this.
-    this->children = std::vector<std::shared_ptr<HTTP::Responses::Node>>();
-    for (const auto& child : other.children) {
-        children.push_back(std::make_shared<Node>(*child));
+std::string HTTP::Responses::FileBody::read_all() {
+    // Read the whole file with positioned reads so the offset isn't shared.
+    std::string contents(length, '\0');
+    size_t total = 0;
+    while (total < length) {
+        ssize_t bytes_read = pread(fd, &contents[total], length - total, total);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            throw std::runtime_error("Failed to read file");
+        }
+        total += bytes_read;
     }
 
-    return *this;
+    return contents;
 }
 
-HTTP::Responses::Node::~Node() {
-    return;
-}
+std::string HTTP::Responses::HTTPResponse::toString() {
+    // Setup variable for raw string.
+    std::string raw = get_head();
 
-HTTP::Responses::ResponseBuilder::ResponseBuilder() {
+    // Add body.
+    raw += file ? file->read_all() : cached ? std::string(cached->get_data(encoding)) : body;
+
+    return raw;
+}
+
+std::string HTTP::Responses::HTTPResponse::get_status_line() {
+    // Use the line written out at compile time.
+    const HTTP::Responses::StatusInfo* info = HTTP::Responses::FindStatus(status);
+    if (info) {
+        return std::string(info->line);
+    }
+
+    // Format codes without a known reason.
+    return "HTTP/1.1 " + std::to_string(status) + " Unknown Status\r\n";
+}
+
+static void append_header(std::string& block, std::string_view name, std::string_view value) {
+    block.append(name.data(), name.size());
+    block += ": ";
+    block.append(value.data(), value.size());
+    block += "\r\n";
+}
+
+static void append_headers(std::string& block, const HTTP::Responses::HTTPResponse& response) {
+    // Start with the route's headers, which were serialized ahead of time.
+    if (response.fixed_headers) {
+        block += *response.fixed_headers;
+    }
+
+    // Add the response's own headers, noting the ones that replace what would be filled in, a cached file's block already has its length.
+    bool has_date = false;
+    bool has_length = response.cached != nullptr;
+    bool has_connection = false;
+    for (const std::pair<const std::string, std::string>& pair : response.headers) {
+        append_header(block, pair.first, pair.second);
+        has_date = has_date || HTTP::Requests::EqualsIgnoreCase(pair.first, "Date");
+        has_length = has_length || HTTP::Requests::EqualsIgnoreCase(pair.first, "Content-Length");
+        has_connection = has_connection || HTTP::Requests::EqualsIgnoreCase(pair.first, "Connection");
+    }
+
+    // Fill in the fields that change per response.
+    if (!has_date) {
+        append_header(block, "Date", HTTP::Responses::get_date());
+    }
+    if (!has_length && response.status >= 200 && response.status != 204 && response.status != 304) {
+        char digits[24];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), response.file ? response.file->length : response.body.size());
+        append_header(block, "Content-Length", std::string_view(digits, result.ptr - digits));
+    }
+    if (!has_connection) {
+        append_header(block, "Connection", response.keep_alive ? "keep-alive" : "close");
+    }
+
+    // Add blank line ending the headers.
+    block += "\r\n";
+}
+
+std::string HTTP::Responses::HTTPResponse::get_header_block() {
+    // Setup variable for headers.
+    std::string block;
+    append_headers(block, *this);
+
+    return block;
+}
+
+std::string HTTP::Responses::HTTPResponse::get_head() {
+    // Write the status line and headers into one buffer sized for the usual case.
+    std::string head;
+    head.reserve(192 + (fixed_headers ? fixed_headers->size() : 0));
+    const HTTP::Responses::StatusInfo* info = HTTP::Responses::FindStatus(status);
+    if (info) {
+        head.append(info->line.data(), info->line.size());
+    } else {
+        head += get_status_line();
+    }
+    append_headers(head, *this);
+
+    return head;
+}
+
+static bool contains_token(std::string_view list, std::string_view token) {
+    // Check each comma separated item, ignoring case and spaces around it.
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string_view::npos) {
+            end = list.size();
+        }
+        if (HTTP::Requests::EqualsIgnoreCase(trim(list.substr(start, end - start)), token)) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+HTTP::Responses::ResponseParser::ResponseParser(bool no_body) {
+    Reset(no_body);
+}
+
+void HTTP::Responses::ResponseParser::Reset(bool no_body) {
+    // Wait for a new head.
+    this->stage = Stage::Head;
+    this->scanned = 0;
+    this->no_body = no_body;
+    this->persistent = false;
+    this->decoder.Reset(0);
+}
+
+void HTTP::Responses::ResponseParser::ParseHead(std::string_view head, HTTP::Responses::HTTPResponse& response) {
+    // Check the status line is "HTTP/1.x NNN reason".
+    size_t line_end = head.find('\n');
+    std::string_view line = head.substr(0, line_end);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || !std::isdigit(static_cast<unsigned char>(line[7])) || line[8] != ' ' || (line.size() > 12 && line[12] != ' ')) {
+        throw std::invalid_argument("Invalid HTTP response status line");
+    }
+    int status = 0;
+    for (size_t i = 9; i < 12; i++) {
+        if (!std::isdigit(static_cast<unsigned char>(line[i]))) {
+            throw std::invalid_argument("Invalid HTTP response status code");
+        }
+        status = status * 10 + (line[i] - '0');
+    }
+    response.status = status;
+    response.headers.clear();
+    response.body.clear();
+    response.file.reset();
+    response.cached.reset();
+    response.encoding = Cache::Encoding::Identity;
+
+    // Read each header, keeping the ones that frame the body.
+    bool close = line[7] == '0';
+    bool chunked = false;
+    bool has_transfer_encoding = false;
+    std::string_view content_length;
+    size_t position = line_end + 1;
+    while (position < head.size()) {
+        size_t end = head.find('\n', position);
+        std::string_view header = head.substr(position, end - position);
+        position = end + 1;
+        if (!header.empty() && header.back() == '\r') {
+            header.remove_suffix(1);
+        }
+        if (header.empty()) {
+            break;
+        }
+
+        // Split the name from the value.
+        size_t colon = header.find(':');
+        if (colon == std::string_view::npos || colon == 0 || Scan::FindNotIn(header.data(), colon, Scan::Token()) != colon) {
+            throw std::invalid_argument("Invalid header in HTTP response");
+        }
+        std::string_view name = header.substr(0, colon);
+        std::string_view value = trim(header.substr(colon + 1));
+
+        // Repeats of a header are joined into a list.
+        std::string& slot = response.headers[std::string(name)];
+        if (!slot.empty()) {
+            slot += ", ";
+        }
+        slot += value;
+
+        if (HTTP::Requests::EqualsIgnoreCase(name, "Content-Length")) {
+            // Lengths that disagree can't be trusted.
+            if (!content_length.empty() && content_length != value) {
+                throw std::invalid_argument("Conflicting Content-Length in HTTP response");
+            }
+            content_length = value;
+        } else if (HTTP::Requests::EqualsIgnoreCase(name, "Transfer-Encoding")) {
+            // Only the last coding decides the framing.
+            has_transfer_encoding = true;
+            size_t comma = value.rfind(',');
+            chunked = HTTP::Requests::EqualsIgnoreCase(trim(comma == std::string_view::npos ? value : value.substr(comma + 1)), "chunked");
+        } else if (HTTP::Requests::EqualsIgnoreCase(name, "Connection")) {
+            // HTTP/1.1 stays open unless told to close, HTTP/1.0 closes unless told to stay open.
+            if (contains_token(value, "close")) {
+                close = true;
+            } else if (contains_token(value, "keep-alive")) {
+                close = false;
+            }
+        }
+    }
+    persistent = !close;
+
+    // Work out how the body is framed.
+    if (no_body || status / 100 == 1 || status == 204 || status == 304) {
+        // These never have a body, and after 101 the connection is no longer HTTP.
+        stage = Stage::Done;
+        persistent = persistent && status != 101;
+    } else if (has_transfer_encoding) {
+        // A chunked body ends itself, any other coding runs until the connection closes.
+        if (chunked) {
+            decoder.ResetChunked();
+            stage = Stage::Body;
+        } else {
+            stage = Stage::UntilClose;
+            persistent = false;
+        }
+    } else if (!content_length.empty()) {
+        // Read the digits, rejecting anything else so a bad length can't desync the stream.
+        size_t length = 0;
+        for (char c : content_length) {
+            if (c < '0' || c > '9' || length > (SIZE_MAX - 9) / 10) {
+                throw std::invalid_argument("Invalid Content-Length in HTTP response");
+            }
+            length = length * 10 + (c - '0');
+        }
+        decoder.Reset(length);
+        stage = length == 0 ? Stage::Done : Stage::Body;
+    } else {
+        // No framing so the body is everything until the connection closes.
+        stage = Stage::UntilClose;
+        persistent = false;
+    }
+}
+
+size_t HTTP::Responses::ResponseParser::Parse(std::string_view input, HTTP::Responses::HTTPResponse& response) {
+    size_t consumed = 0;
+    while (stage != Stage::Done) {
+        std::string_view rest = input.substr(consumed);
+        switch (stage) {
+            case Stage::Head: {
+                // Look for the blank line, going back a little in case the last search stopped partway through it.
+                size_t end = std::string_view::npos;
+                size_t newline = rest.find('\n', scanned >= 2 ? scanned - 2 : 0);
+                while (newline != std::string_view::npos && end == std::string_view::npos) {
+                    if (newline + 1 < rest.size() && rest[newline + 1] == '\n') {
+                        end = newline + 2;
+                    } else if (newline + 2 < rest.size() && rest[newline + 1] == '\r' && rest[newline + 2] == '\n') {
+                        end = newline + 3;
+                    } else {
+                        newline = rest.find('\n', newline + 1);
+                    }
+                }
+                if ((end == std::string_view::npos && rest.size() > MAX_HEAD_SIZE) || (end != std::string_view::npos && end > MAX_HEAD_SIZE)) {
+                    throw std::invalid_argument("HTTP response headers too large");
+                }
+                if (end == std::string_view::npos) {
+                    // Wait for the rest of the head.
+                    scanned = rest.size();
+                    return consumed;
+                }
+
+                // Parse it, skipping interim responses such as 100 Continue.
+                ParseHead(rest.substr(0, end), response);
+                consumed += end;
+                scanned = 0;
+                if (response.status / 100 == 1 && response.status != 101) {
+                    stage = Stage::Head;
+                }
+                break;
+            }
+            case Stage::Body: {
+                // Take the framing off as much of the body as has arrived.
+                std::string_view chunk;
+                size_t used = decoder.Decode(rest, chunk);
+                response.body.append(chunk.data(), chunk.size());
+                consumed += used;
+                if (decoder.done()) {
+                    stage = Stage::Done;
+                } else if (used == 0) {
+                    return consumed;
+                }
+                break;
+            }
+            case Stage::UntilClose:
+                // Everything is body until the connection closes.
+                response.body.append(rest.data(), rest.size());
+                return input.size();
+            case Stage::Done:
+                break;
+        }
+    }
+
+    return consumed;
+}
+
+void HTTP::Responses::ResponseParser::Finish() {
+    // The close is the end of an unframed body, otherwise the response was cut short.
+    if (stage == Stage::UntilClose) {
+        stage = Stage::Done;
+    } else if (stage != Stage::Done) {
+        throw std::invalid_argument("Connection closed before the whole HTTP response arrived");
+    }
+}
+
+// Copies data into struct.
+HTTP::Responses::Node::Node(const HTTP::Responses::Node& parent, NodeType type, std::string url_part, std::string file_path) : parent(std::make_shared<HTTP::Responses::Node>(parent)), children(std::vector<std::shared_ptr<Node>>()), type(type), url_part(url_part), file_path(file_path) {}
+
+// Copies data into struct.
+HTTP::Responses::Node::Node(std::shared_ptr<HTTP::Responses::Node> parent, NodeType type, std::string url_part, std::string file_path) : parent(parent), children(std::vector<std::shared_ptr<Node>>()), type(type), url_part(url_part), file_path(file_path) {}
+
+// Copies data into struct.
+HTTP::Responses::Node::Node(const HTTP::Responses::Node& other) : parent(other.parent), children(std::vector<std::shared_ptr<Node>>()), type(other.type), url_part(other.url_part), file_path(other.file_path), max_body_size(other.max_body_size), header_block(other.header_block) {
+    // Loop over other's children and copy to here;
+    for (const auto& child : other.children) {
+        children.push_back(std::make_shared<Node>(*child));
+    }
+}
+
+HTTP::Responses::Node::Node() {
+    // Initialize all to empty values.
+    this->parent = nullptr;
+    this->children = std::vector<std::shared_ptr<Node>>();
+    this->type = NAME;
+    this->url_part = std::string();
+    this->file_path = std::string();
+}
+
+HTTP::Responses::Node& HTTP::Responses::Node::operator=(const HTTP::Responses::Node& other) {
+    // Sanity check for copy one variable into itself.
+    if (this == &other) {
+        return *this;
+    }
+    // Check for other parent and if so copy it.
+    if (other.parent) {
+        this->parent = other.parent;
+    }
+    // Copy what the node routes to.
+    this->type = other.type;
+    this->url_part = other.url_part;
+    this->file_path = other.file_path;
+    // Copy the route's limit and headers.
+    this->max_body_size = other.max_body_size;
+    this->header_block = other.header_block;
+    // Copy children into this.
+    this->children = std::vector<std::shared_ptr<HTTP::Responses::Node>>();
+    for (const auto& child : other.children) {
+        children.push_back(std::make_shared<Node>(*child));
+    }
+
+    return *this;
+}
+
+HTTP::Responses::Node::~Node() {
+    return;
+}
+
+HTTP::Responses::ResponseBuilder::ResponseBuilder() {
     // Initialize to empty values.
     this->filename = "";
     this->file = std::ifstream();
@@ -284,8 +1229,9 @@ HTTP::Responses::ResponseBuilder::ResponseBuilder(std::string filename) {
     this->filename = filename;
     this->file = std::ifstream(filename);
 
-    // Initialize urls to be empty.
-    std::map<std::string,Node> urls;
+    // Nodes by their full route, and by their own url part for lines that name their parent that way.
+    std::map<std::string, std::shared_ptr<Node>> routes;
+    std::map<std::string, std::shared_ptr<Node>> parts;
 
     // Loop over every line.
     std::string line;
@@ -320,322 +1266,1510 @@ HTTP::Responses::ResponseBuilder::ResponseBuilder(std::string filename) {
         url_part.erase(0, url_part.find_first_not_of(' '));
         url_part.erase(url_part.find_last_not_of(' ') + 1, std::string::npos);
 
-        // Extract file path of current node data.
-        std::string file_path = line.substr(line.find("path") + 5);
+        // Extract file path of current node data, up to an optional body limit.
+        size_t max_body = line.find(" max_body ", line.find("path"));
+        std::string file_path = line.substr(line.find("path") + 5, max_body == std::string::npos ? std::string::npos : max_body - (line.find("path") + 5));
         // Strip whitespace.
         file_path.erase(0, file_path.find_first_not_of(' '));
         file_path.erase(file_path.find_last_not_of(' ') + 1, std::string::npos);
 
+        // Find the parent, the site's host is the root and anything else is a full route or a url part seen before.
+        std::shared_ptr<Node> parent = nullptr;
+        std::string route;
+        if (this->tree && parent_url == this->tree->url_part) {
+            parent = this->tree;
+        } else if (routes.find(parent_url) != routes.end()) {
+            parent = routes.find(parent_url)->second;
+            route = parent_url;
+        } else if (parts.find(parent_url) != parts.end()) {
+            parent = parts.find(parent_url)->second;
+        } else if (this->tree) {
+            throw std::runtime_error("Error parsing " + filename + " website structure: Unknown parent " + parent_url);
+        }
+
         // Copy data into node.
-        Node node((urls.find(parent_url) != urls.end()) ? (std::make_shared<Node>(urls.find(parent_url)->second)) : (nullptr), type, url_part, file_path);
-        // If the node has no parent and tree is null, set tree to point to this node.
-        if (node.parent == nullptr && this->tree == nullptr) {
-            this->tree = std::make_shared<Node>(node);
-        // If the node has a parent add it to the parents children list.
-        } else if (node.parent == nullptr) {
-            node.parent = tree;
-            node.parent->children.push_back(std::make_shared<Node>(node));
+        std::shared_ptr<Node> node = std::make_shared<Node>(parent, type, url_part, file_path);
+        if (max_body != std::string::npos) {
+            try {
+                node->max_body_size = std::stoull(line.substr(max_body + 10));
+            } catch (const std::logic_error& e) {
+                throw std::runtime_error("Error parsing " + filename + " website structure: Invalid max_body, use a number of bytes");
+            }
+        }
+
+        // The first node is the site itself, every other one goes under its parent.
+        if (!this->tree) {
+            this->tree = node;
+            continue;
+        }
+        parent->children.push_back(node);
+
+        // Remember the node by its full route and its url part, a parent found by url part has its route worked out from the tree.
+        if (route.empty()) {
+            for (Node* current = parent.get(); current != this->tree.get(); current = current->parent.get()) {
+                route.insert(0, current->url_part);
+            }
+        }
+        routes[route + url_part] = node;
+        parts[url_part] = node;
+    }
+
+    // Compile the tree for lookups.
+    if (this->tree) {
+        this->router = HTTP::Responses::Router(*this->tree);
+    }
+}
+
+HTTP::Responses::ResponseBuilder::ResponseBuilder(const HTTP::Responses::ResponseBuilder& other) {
+    // Copy data from other into this.
+    this->filename = other.filename;
+    this->file = std::ifstream(other.filename);
+    this->tree = other.tree;
+    this->router = other.router;
+    this->cache = other.cache;
+}
+
+std::pair<std::string, std::string> HTTP::Responses::split_url(std::string_view url) {
+    // Host is everything before the first /, route is the rest.
+    size_t slash = url.find('/');
+    std::string_view host = url.substr(0, slash);
+    std::string_view route = slash == std::string_view::npos ? std::string_view() : url.substr(slash + 1);
+
+    // Drop a trailing / then trailing spaces.
+    if (!route.empty() && route.back() == '/') {
+        route.remove_suffix(1);
+    }
+    size_t last = route.find_last_not_of(' ');
+    route = route.substr(0, last == std::string_view::npos ? 0 : last + 1);
+
+    // If route is empty put in a /
+    if (route.empty()) {
+        route = "/";
+    }
+
+    return std::make_pair(std::string(host), std::string(route));
+}
+
+std::vector<std::string> HTTP::Responses::split_route(std::string_view route) {
+    // Split by every /.
+    return split(route, '/');
+}
+
+static int parse_quality(std::string_view parameters) {
+    // Find the q parameter, a coding without one has the highest quality.
+    while (!parameters.empty()) {
+        size_t semicolon = parameters.find(';');
+        std::string_view field = trim(parameters.substr(0, semicolon));
+        parameters = semicolon == std::string_view::npos ? std::string_view() : parameters.substr(semicolon + 1);
+        if (field.size() < 2 || (field[0] != 'q' && field[0] != 'Q') || field[1] != '=') {
+            continue;
+        }
+
+        // A quality is 0 or 1 with up to three decimals, kept in thousandths.
+        std::string_view value = field.substr(2);
+        if (value.empty() || value.size() > 5 || (value[0] != '0' && value[0] != '1') || (value.size() > 1 && value[1] != '.')) {
+            return -1;
+        }
+        int quality = (value[0] - '0') * 1000;
+        int scale = 100;
+        for (size_t i = 2; i < value.size(); i++, scale /= 10) {
+            if (!std::isdigit(static_cast<unsigned char>(value[i]))) {
+                return -1;
+            }
+            quality += (value[i] - '0') * scale;
+        }
+        return quality > 1000 ? -1 : quality;
+    }
+    return 1000;
+}
+
+Cache::Encoding HTTP::Responses::ChooseEncoding(std::string_view accept_encoding, const Cache::Entry& entry) {
+    // The quality of each coding in thousandths, -1 if it wasn't listed.
+    int gzip = -1;
+    int deflate = -1;
+    int identity = -1;
+    int any = -1;
+    while (!accept_encoding.empty()) {
+        size_t comma = accept_encoding.find(',');
+        std::string_view item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+
+        // The coding comes before its parameters, malformed qualities are ignored.
+        size_t semicolon = item.find(';');
+        std::string_view coding = trim(item.substr(0, semicolon));
+        int quality = semicolon == std::string_view::npos ? 1000 : parse_quality(item.substr(semicolon + 1));
+        if (quality < 0) {
+            continue;
+        }
+        if (HTTP::Requests::EqualsIgnoreCase(coding, "gzip") || HTTP::Requests::EqualsIgnoreCase(coding, "x-gzip")) {
+            gzip = quality;
+        } else if (HTTP::Requests::EqualsIgnoreCase(coding, "deflate")) {
+            deflate = quality;
+        } else if (HTTP::Requests::EqualsIgnoreCase(coding, "identity")) {
+            identity = quality;
+        } else if (coding == "*") {
+            any = quality;
+        }
+    }
+
+    // Codings not listed take the quality of *, except identity which is still acceptable but loses to any coding that was listed.
+    gzip = gzip >= 0 ? gzip : std::max(any, 0);
+    deflate = deflate >= 0 ? deflate : std::max(any, 0);
+    identity = identity >= 0 ? identity : any >= 0 ? any : 1;
+
+    // Take the best the entry has, ties go to the smaller encodings.
+    Cache::Encoding chosen = Cache::Encoding::Identity;
+    int best = identity;
+    if (entry.has(Cache::Encoding::Deflate) && deflate > 0 && deflate >= best) {
+        chosen = Cache::Encoding::Deflate;
+        best = deflate;
+    }
+    if (entry.has(Cache::Encoding::Gzip) && gzip > 0 && gzip >= best) {
+        chosen = Cache::Encoding::Gzip;
+    }
+    return chosen;
+}
+
+static bool parse_date(std::string_view value, time_t& time) {
+    static constexpr char MONTHS[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    // Copy it out so sscanf has a terminator.
+    char text[64];
+    value = trim(value);
+    if (value.size() >= sizeof(text)) {
+        return false;
+    }
+    memcpy(text, value.data(), value.size());
+    text[value.size()] = '\0';
+
+    // Try IMF-fixdate, then the obsolete RFC 850 and asctime forms, each must use the whole value.
+    char month[4] = {};
+    tm parts = {};
+    int end = 0;
+    int length = static_cast<int>(value.size());
+    if (sscanf(text, "%*3[A-Za-z], %2d %3[A-Za-z] %4d %2d:%2d:%2d GMT%n", &parts.tm_mday, month, &parts.tm_year, &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &end) == 6 && end == length) {
+        parts.tm_year -= 1900;
+    } else if (end = 0, sscanf(text, "%*[A-Za-z], %2d-%3[A-Za-z]-%2d %2d:%2d:%2d GMT%n", &parts.tm_mday, month, &parts.tm_year, &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &end) == 6 && end == length) {
+        // Two digit years are taken as the closest century that isn't far in the future.
+        parts.tm_year += parts.tm_year < 70 ? 100 : 0;
+    } else if (end = 0, sscanf(text, "%*3[A-Za-z] %3[A-Za-z] %2d %2d:%2d:%2d %4d%n", month, &parts.tm_mday, &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &parts.tm_year, &end) == 6 && end == length) {
+        parts.tm_year -= 1900;
+    } else {
+        return false;
+    }
+
+    // Look the month up.
+    parts.tm_mon = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(month, MONTHS[i]) == 0) {
+            parts.tm_mon = i;
+        }
+    }
+    if (parts.tm_mon < 0 || parts.tm_mday < 1 || parts.tm_mday > 31 || parts.tm_hour > 23 || parts.tm_min > 59 || parts.tm_sec > 60) {
+        return false;
+    }
+    time = timegm(&parts);
+    return true;
+}
+
+static bool matches_etag(std::string_view list, std::string_view etag, bool strong) {
+    // * matches any current representation.
+    if (trim(list) == "*") {
+        return true;
+    }
+
+    // Step through each tag, which is quoted and can hold commas.
+    size_t position = 0;
+    while (position < list.size()) {
+        // Skip the separators before the tag.
+        if (list[position] == ',' || list[position] == ' ' || list[position] == '\t') {
+            position++;
+            continue;
+        }
+        bool weak = list.compare(position, 2, "W/") == 0;
+        if (weak) {
+            position += 2;
+        }
+        if (position >= list.size() || list[position] != '"') {
+            return false;
+        }
+        size_t close = list.find('"', position + 1);
+        if (close == std::string_view::npos) {
+            return false;
+        }
+
+        // Strong comparison needs both tags strong, ours always are.
+        if ((!strong || !weak) && list.substr(position, close - position + 1) == etag) {
+            return true;
+        }
+        position = close + 1;
+    }
+    return false;
+}
+
+HTTP::Responses::Status HTTP::Responses::CheckConditions(const HTTP::Requests::HTTPRequest& request, std::string_view etag, time_t modified) {
+    const std::string* if_match = request.headers.get(HTTP::Requests::KnownHeader::IfMatch);
+    const std::string* if_unmodified_since = request.headers.get(HTTP::Requests::KnownHeader::IfUnmodifiedSince);
+    const std::string* if_none_match = request.headers.get(HTTP::Requests::KnownHeader::IfNoneMatch);
+    const std::string* if_modified_since = request.headers.get(HTTP::Requests::KnownHeader::IfModifiedSince);
+    bool safe = request.method == "GET" || request.method == "HEAD";
+    time_t date;
+
+    // A client changing the resource needs the version it expects, If-Unmodified-Since only counts without If-Match.
+    if (if_match && !matches_etag(*if_match, etag, true)) {
+        return HTTP::Responses::Status::PreconditionFailed;
+    }
+    if (!if_match && if_unmodified_since && parse_date(*if_unmodified_since, date) && modified > date) {
+        return HTTP::Responses::Status::PreconditionFailed;
+    }
+
+    // A client holding the current version only needs to be told so, If-Modified-Since only counts without If-None-Match.
+    if (if_none_match) {
+        if (matches_etag(*if_none_match, etag, false)) {
+            return safe ? HTTP::Responses::Status::NotModified : HTTP::Responses::Status::PreconditionFailed;
+        }
+    } else if (safe && if_modified_since && parse_date(*if_modified_since, date) && modified <= date) {
+        return HTTP::Responses::Status::NotModified;
+    }
+    return HTTP::Responses::Status::OK;
+}
+
+HTTP::Responses::Router::Router() : nodes(), first_bytes(), labels(), route_count(0) {
+    // A root with no label or children matches nothing.
+    nodes.push_back(TrieNode{0, 0, 0, 0, nullptr});
+    first_bytes.push_back('\0');
+}
+
+static void collect_routes(HTTP::Responses::Node& node, std::string& path, std::map<std::string, HTTP::Responses::Node*>& routes) {
+    // Each child owns its url part under its parent's path.
+    for (const std::shared_ptr<HTTP::Responses::Node>& child : node.children) {
+        size_t length = path.size();
+        std::string_view part = child->url_part;
+        while (!part.empty() && part.front() == '/') {
+            part.remove_prefix(1);
+        }
+        while (!part.empty() && part.back() == '/') {
+            part.remove_suffix(1);
+        }
+        if (!part.empty()) {
+            path += '/';
+            path += part;
+        }
+
+        // The first node to claim a path keeps it.
+        routes.emplace(path.empty() ? std::string("/") : path, child.get());
+        collect_routes(*child, path, routes);
+        path.resize(length);
+    }
+}
+
+HTTP::Responses::Router::Router(HTTP::Responses::Node& root) : Router() {
+    // Work out every node's path, sorted so paths sharing a prefix are next to each other.
+    std::map<std::string, HTTP::Responses::Node*> routes;
+    std::string path;
+    routes.emplace("/", &root);
+    collect_routes(root, path, routes);
+    std::vector<std::pair<std::string, HTTP::Responses::Node*>> paths(routes.begin(), routes.end());
+    route_count = paths.size();
+
+    // Build the trie down from the root.
+    Compile(0, paths, 0, paths.size(), 0);
+}
+
+void HTTP::Responses::Router::Compile(uint32_t index, const std::vector<std::pair<std::string, HTTP::Responses::Node*>>& paths, size_t begin, size_t end, size_t depth) {
+    // A path that ends here is the node's route, sorting puts it first.
+    if (begin < end && paths[begin].first.size() == depth) {
+        nodes[index].route = paths[begin].second;
+        begin++;
+    }
+
+    // Group the rest by their next byte, each group becomes a child.
+    std::vector<std::pair<size_t, size_t>> groups;
+    for (size_t i = begin; i < end;) {
+        size_t j = i + 1;
+        while (j < end && paths[j].first[depth] == paths[i].first[depth]) {
+            j++;
         }
+        groups.push_back(std::make_pair(i, j));
+        i = j;
+    }
+
+    // Put the children next to each other, then fill each in.
+    uint32_t first = static_cast<uint32_t>(nodes.size());
+    nodes[index].first_child = first;
+    nodes[index].child_count = static_cast<uint32_t>(groups.size());
+    nodes.resize(first + groups.size());
+    first_bytes.resize(first + groups.size());
+    for (size_t i = 0; i < groups.size(); i++) {
+        // The label is everything the group shares, which is what its first and last paths share since they are sorted.
+        const std::string& low = paths[groups[i].first].first;
+        const std::string& high = paths[groups[i].second - 1].first;
+        size_t length = depth;
+        while (length < low.size() && length < high.size() && low[length] == high[length]) {
+            length++;
+        }
+        nodes[first + i] = TrieNode{static_cast<uint32_t>(labels.size()), static_cast<uint32_t>(length - depth), 0, 0, nullptr};
+        first_bytes[first + i] = low[depth];
+        labels.append(low, depth, length - depth);
+        Compile(first + i, paths, groups[i].first, groups[i].second, length);
+    }
+}
+
+HTTP::Responses::Node* HTTP::Responses::Router::Find(std::string_view path) const {
+    uint32_t index = 0;
+    size_t position = 0;
+    while (true) {
+        // The whole label must match.
+        const TrieNode& node = nodes[index];
+        if (path.size() - position < node.label_length || memcmp(path.data() + position, labels.data() + node.label_start, node.label_length) != 0) {
+            return nullptr;
+        }
+        position += node.label_length;
+        if (position == path.size()) {
+            return node.route;
+        }
+
+        // Children have distinct first bytes, so a binary search over at most 256 picks the only one that can match.
+        const char* children = first_bytes.data() + node.first_child;
+        const char* children_end = children + node.child_count;
+        const char* child = std::lower_bound(children, children_end, path[position], [](char a, char b) {
+            return static_cast<unsigned char>(a) < static_cast<unsigned char>(b);
+        });
+        if (child == children_end || *child != path[position]) {
+            return nullptr;
+        }
+        index = static_cast<uint32_t>(child - first_bytes.data());
+    }
+}
+
+HTTP::Responses::Node* HTTP::Responses::ResponseBuilder::route(std::string_view url) {
+    // The host is everything before the path.
+    size_t slash = url.find('/');
+    if (!tree || url.substr(0, slash) != tree->url_part) {
+        return nullptr;
+    }
+
+    // Match the normalized path in the trie.
+    return router.Find(slash == std::string_view::npos ? std::string_view("/") : url.substr(slash));
+}
+
+static const std::shared_ptr<const std::string>& html_headers() {
+    // Error pages share one block.
+    static const std::shared_ptr<const std::string> block = std::make_shared<const std::string>("Content-Type: text/html\r\n");
+    return block;
+}
+
+static void precondition_failed(HTTP::Responses::HTTPResponse& response) {
+    // The client's version isn't the current one.
+    response.status = 412;
+    response.fixed_headers = html_headers();
+    response.body = "<!DOCTYPE html><html><head><title>Error</title></head><body><h1>An error ocurred</h1><p>A precondition of the request failed</p></body></html>";
+}
+
+HTTP::Responses::HTTPResponse HTTP::Responses::ResponseBuilder::build(HTTP::Requests::HTTPRequest& request) {
+    // Initialize template OK response, Date, Content-Length and Connection are filled in when it is written.
+    HTTP::Responses::HTTPResponse response(200, std::map<std::string,std::string>(), "");
+    response.fixed_headers = html_headers();
+
+    // Find the node for the url.
+    Node* current = route(request.url);
+    if (!current) {
+        response.status = 404;
+        response.body = "<!DOCTYPE html><html><head><title>Error</title></head><body><h1>An error ocurred</h1><p>The page could not be found</p></body></html>";
+        return response;
+    }
+
+    // Serialize the route's headers the first time it is used.
+    if (!current->header_block) {
+        current->header_block = std::make_shared<const std::string>("Content-Type: " + std::string(current->type == API ? std::string_view("text/html") : Cache::ContentType(current->file_path)) + "\r\n");
+    }
+    response.fixed_headers = current->header_block;
+
+    // Static pages are served from memory, or opened and sent straight from the fd if the cache has no room, only the headers are built here.
+    try {
+        std::shared_ptr<const Cache::Entry> entry = cache ? cache->Get(current->file_path) : nullptr;
+
+        // API scripts are copied into the body.
+        if (current->type == API) {
+            response.body = entry ? std::string(entry->data) : HTTP::Responses::FileBody(current->file_path).read_all();
+            return response;
+        }
+        if (entry) {
+            // Choose the variant the client prefers, then check the client's copy of it before sending any body.
+            const std::string* accept_encoding = request.headers.get(HTTP::Requests::KnownHeader::AcceptEncoding);
+            Cache::Encoding encoding = HTTP::Responses::ChooseEncoding(accept_encoding ? std::string_view(*accept_encoding) : std::string_view(), *entry);
+            HTTP::Responses::Status condition = HTTP::Responses::CheckConditions(request, entry->get_etag(encoding), entry->mtime.tv_sec);
+            if (condition == HTTP::Responses::Status::NotModified) {
+                response.status = 304;
+                response.fixed_headers = std::shared_ptr<const std::string>(entry, &entry->get_not_modified_block(encoding));
+                return response;
+            }
+            if (condition == HTTP::Responses::Status::PreconditionFailed) {
+                precondition_failed(response);
+                return response;
+            }
+
+            // Send the variant, its block says how it is encoded.
+            response.cached = entry;
+            response.encoding = encoding;
+            response.fixed_headers = std::shared_ptr<const std::string>(entry, &entry->get_header_block(encoding));
+            return response;
+        }
+
+        // Files too big for the cache are checked from their status, then sent from the fd.
+        std::shared_ptr<HTTP::Responses::FileBody> file = std::make_shared<HTTP::Responses::FileBody>(current->file_path);
+        HTTP::Responses::Status condition = HTTP::Responses::CheckConditions(request, file->etag, file->modified);
+        if (condition == HTTP::Responses::Status::PreconditionFailed) {
+            precondition_failed(response);
+            return response;
+        }
+        char last_modified[30];
+        Cache::FormatDate(file->modified, last_modified);
+        response.headers["ETag"] = file->etag;
+        response.headers["Last-Modified"] = std::string(last_modified, 29);
+        if (condition == HTTP::Responses::Status::NotModified) {
+            response.status = 304;
+            response.fixed_headers.reset();
+            return response;
+        }
+        response.file = file;
+    } catch (const std::runtime_error& e) {
+        response.status = 404;
+        response.fixed_headers = html_headers();
+        response.body = "<!DOCTYPE html><html><head><title>Error</title></head><body><h1>An error ocurred</h1><p>The page could not be found</p></body></html>";
+        return response;
+    }
+
+    return response;
+}
+
+HTTP::Responses::ResponseBuilder& HTTP::Responses::ResponseBuilder::operator=(const HTTP::Responses::ResponseBuilder& other) {
+    // Check if we are copying a variable into itself.
+    if (this == &other) {
+        return *this;
+    }
+    // Copy data from other into this.
+    this->filename = other.filename;
+    this->file = std::ifstream(other.filename);
+    this->tree = other.tree;
+    this->router = other.router;
+    this->cache = other.cache;
+    return *this;
+}
+
+static void unlink_parents(HTTP::Responses::Node& node) {
+    // Drop every child's pointer back up so the nodes can be freed.
+    for (const std::shared_ptr<HTTP::Responses::Node>& child : node.children) {
+        child->parent = nullptr;
+        unlink_parents(*child);
+    }
+}
+
+HTTP::Responses::ResponseBuilder::~ResponseBuilder() {
+    // Close file to clean resources.
+    file.close();
+
+    // Parents and children own each other, so unlink them once only the root's children still hold the tree.
+    if (tree && static_cast<size_t>(tree.use_count()) == 1 + tree->children.size()) {
+        unlink_parents(*tree);
+    }
+    return;
+}
+
+HTTP::Servers::Connection::Connection(std::shared_ptr<Sockets::Socket> client, Buffers::SlabPool& pool) : client(client), state(ConnectionState::Idle), input(pool), parser(), output(), output_offset(0), output_bytes(0), reading_paused(false), request(), body_decoder(), body(), max_body_size(0), keep_alive(true), peer_closed(false), unread(false), send_in_flight(false), close_sent(false), next_sequence(0), next_response(0), held(), request_start(0), timer(client->get_fd()) {}
+
+HTTP::Servers::Connection::~Connection() {
+    return;
+}
+
+static HTTP::Requests::HTTPRequest read_request(Sockets::Socket& server, Sockets::Socket& client, Buffers::RecvBuffer& input, HTTP::Requests::RequestParser& parser, const HTTP::Servers::ServerConfig& config) {
+    HTTP::Requests::RequestView view;
+    std::unique_ptr<HTTP::Requests::HTTPRequest> request;
+    HTTP::Requests::BodyDecoder decoder;
+    std::shared_ptr<HTTP::Requests::RequestBody> body = std::make_shared<HTTP::Requests::RequestBody>(config.body_spill_threshold, config.temp_directory);
+    while (true) {
+        // Parse whatever arrived since the last read.
+        if (!request) {
+            size_t header_length = parser.Parse(input.view(), view);
+            if (header_length != 0) {
+                HTTP::Requests::NormalizeTarget(input.data(), view);
+                if (!HTTP::Requests::StartBody(view, decoder)) {
+                    throw std::invalid_argument("Unsupported Transfer-Encoding in HTTP request");
+                }
+                request = std::make_unique<HTTP::Requests::HTTPRequest>(view, std::string_view());
+                input.Consume(header_length);
+                parser.Reset();
+            }
+        }
+
+        // Decode the body as it arrives.
+        while (request && !decoder.done()) {
+            std::string_view chunk;
+            size_t consumed = decoder.Decode(input.view(), chunk);
+            if (decoder.get_decoded() > config.max_body_size) {
+                throw std::invalid_argument("Request body too large");
+            }
+            body->Append(chunk);
+            input.Consume(consumed);
+            if (consumed == 0) {
+                break;
+            }
+        }
+
+        // Hand the request out once the body is all in.
+        if (request && decoder.done()) {
+            if (body->spilled()) {
+                request->body_file = body;
+            } else {
+                request->body = std::move(body->memory);
+            }
+            return std::move(*request);
+        }
+
+        // Wait for more of the request, reading headers no further than the largest allowed and the body a few spill-sized chunks at a time.
+        if (!request && input.size() > config.max_header_size) {
+            throw std::invalid_argument("Request headers too large");
+        }
+        size_t limit = request ? std::max<size_t>(config.body_spill_threshold, 4096) * 4 : config.max_header_size + 1 - input.size();
+        bool closed = false;
+        if (server.RecvAvailable(client, input, closed, limit) == 0) {
+            if (closed) {
+                throw std::runtime_error("Client closed before sending a whole request");
+            }
+            pollfd readable = {client.get_fd(), POLLIN, 0};
+            poll(&readable, 1, -1);
+        }
+    }
+}
+
+static void consume_output(HTTP::Servers::Connection& connection, size_t sent) {
+    connection.output_bytes -= sent;
+
+    // Drop the memory segments that were fully sent and remember where the partial one stopped.
+    size_t remaining = sent + connection.output_offset;
+    while (!connection.output.empty() && !connection.output.front().file && remaining >= connection.output.front().size()) {
+        remaining -= connection.output.front().size();
+        connection.output.pop_front();
+    }
+    connection.output_offset = remaining;
+}
+
+static bool awaiting_responses(const HTTP::Servers::Connection& connection) {
+    // Requests without a response yet, or responses not fully written.
+    return connection.next_response != connection.next_sequence || !connection.output.empty();
+}
+
+static void stop_reading(HTTP::Servers::Connection& connection) {
+    // The client won't send another request, close once the ones it already sent are answered.
+    connection.keep_alive = false;
+    connection.state = awaiting_responses(connection) ? HTTP::Servers::ConnectionState::Writing : HTTP::Servers::ConnectionState::Closing;
+}
+
+static int send_blocking(Sockets::Socket& server, Sockets::Socket& client, HTTP::Responses::HTTPResponse& response) {
+    // Send the head and body together, then any file after them.
+    std::string head = response.get_head();
+    std::string_view body = response.cached ? response.cached->get_data(response.encoding) : std::string_view(response.body);
+    int res = server.SendV(client, {iovec{head.data(), head.size()}, iovec{const_cast<char*>(body.data()), body.size()}});
+    if (response.file) {
+        res = server.SendFile(client, response.file->fd, 0, response.file->length);
+    }
+    return res;
+}
+
+HTTP::Servers::HTTPServer::HTTPServer(std::string website_tree_filename) : HTTPServer(website_tree_filename, HTTP::Servers::ServerConfig()) {}
+
+HTTP::Servers::HTTPServer::HTTPServer(std::string website_tree_filename, HTTP::Servers::ServerConfig config) {
+    // Initialize response builder, keeping static files in a shared cache, or one of its own if there is a budget for it.
+    this->response_builder = HTTP::Responses::ResponseBuilder(website_tree_filename);
+    if (config.content_cache) {
+        this->response_builder.cache = config.content_cache;
+    } else if (config.content_cache_size != 0) {
+        this->response_builder.cache = std::make_shared<Cache::ContentCache>(config.content_cache_size);
+    }
+    // Initialize address for socket.
+    sockaddr_in addr = {0, 0, 0, 0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.address.c_str(), &addr.sin_addr) <= 0) {
+        throw std::invalid_argument("Invalid address " + config.address);
+    }
+    // Create socket.
+    std::unique_ptr<Sockets::Socket> server = std::make_unique<Sockets::Socket>(AF_INET, SOCK_STREAM, reinterpret_cast<sockaddr&>(addr));
+    if (config.reuse_port) {
+        server->SetReusePort();
+    }
+    server->Bind();
+    server->Listen(config.backlog);
+    // Make server non-blocking so the whole backlog can be drained on each wake up.
+    server->SetNonBlocking();
+    this->socket = std::move(server);
+    this->running = 1;
+    this->config = config;
+    this->run_expired = false;
+    // Initialize accept counters.
+    this->accept_wakeups = 0;
+    this->accept_total = 0;
+    this->accept_last_batch = 0;
+    this->accept_max_batch = 0;
+    this->accept_backlog_full = 0;
+    this->accept_errors = 0;
+    // Setup backend for accepting and handling clients.
+    StartBackend(config.backend);
+}
+
+HTTP::Servers::HTTPServer::~HTTPServer() {
+    // Stop running so handling loops know to stop.
+    this->running = 0;
+    // Destroy backend before the fds it watches, then close wake fd.
+    backend.reset();
+    close(wake_fd);
+}
+
+void HTTP::Servers::HTTPServer::Stop() {
+    // Stop running and wake up the backend so the loop sees it.
+    this->running = 0;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        perror("write");
+    }
+}
+
+IO::BackendType HTTP::Servers::HTTPServer::get_backend_type() {
+    // Give backend type out.
+    return backend->get_type();
+}
+
+Sockets::Socket& HTTP::Servers::HTTPServer::get_socket() {
+    // Give server socket out.
+    return *socket;
+}
+
+HTTP::Servers::AcceptStats HTTP::Servers::HTTPServer::get_accept_stats() {
+    // Copy counters into a snapshot.
+    HTTP::Servers::AcceptStats stats;
+    stats.wakeups = accept_wakeups;
+    stats.accepted = accept_total;
+    stats.last_batch = accept_last_batch;
+    stats.max_batch = accept_max_batch;
+    stats.backlog_full = accept_backlog_full;
+    stats.errors = accept_errors;
+    return stats;
+}
+
+void HTTP::Servers::HTTPServer::StartBackend(IO::BackendType type) {
+    // Create the backend.
+    backend = IO::CreateBackend(type);
+
+    // Watch the server socket for clients.
+    backend->AddListener(socket->get_fd());
+
+    // Add the wake fd so Stop can interrupt waiting.
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        throw std::runtime_error("Failed to create wake eventfd");
+    }
+    backend->AddWake(wake_fd);
+}
+
+void HTTP::Servers::HTTPServer::AcceptClients() {
+    // Check if the accept queue was full, which means the kernel has been dropping connections.
+    tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(socket->get_fd(), IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 && info.tcpi_sacked > 0 && info.tcpi_unacked >= info.tcpi_sacked) {
+        accept_backlog_full++;
+    }
+
+    // Accept every waiting client without holding the lock.
+    std::vector<std::shared_ptr<Sockets::Socket>> accepted;
+    try {
+        socket->AcceptBatch(accepted);
+    } catch (const std::runtime_error& e) {
+        // Out of fds or memory, keep what was accepted and try again on the next wake up.
+        accept_errors++;
+    }
+
+    // Register the batch.
+    RegisterClients(accepted);
+}
+
+void HTTP::Servers::HTTPServer::RegisterClients(std::vector<std::shared_ptr<Sockets::Socket>>& accepted) {
+    // Update counters.
+    accept_wakeups++;
+    accept_total += accepted.size();
+    accept_last_batch = accepted.size();
+    if (accepted.size() > accept_max_batch) {
+        accept_max_batch = accepted.size();
+    }
+
+    // Lock mutex once for the whole batch.
+    std::lock_guard<std::mutex> lock(sockets_mutex);
+    for (std::shared_ptr<Sockets::Socket>& client : accepted) {
+        // Start tracking the connection in the slot for its fd.
+        size_t fd = client->get_fd();
+        if (fd >= connections.size()) {
+            connections.resize(std::max(fd + 1, connections.size() * 2));
+        }
+        if (connections[fd]) {
+            // The backend already closed the last client with this fd, so don't let it close the new one.
+            connections[fd]->client->Release();
+        }
+        connections[fd] = std::make_shared<HTTP::Servers::Connection>(client, buffer_pool);
+
+        // Give the client until the header timeout to send its first request.
+        connections[fd]->request_start = Timers::Now();
+        timers.Arm(connections[fd]->timer, connections[fd]->request_start + config.header_timeout);
+
+        // Start watching the client.
+        backend->AddClient(client->get_fd());
+    }
+}
+
+void HTTP::Servers::HTTPServer::PollClients(std::vector<std::unique_ptr<HTTP::Servers::Data>>& completed) {
+    // Wait for events, without blocking if some connections still have input to handle and only until the next deadline otherwise.
+    int timeout = 0;
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        if (pending.empty()) {
+            timeout = timers.NextTimeout(Timers::Now());
+        }
+    }
+    backend->Wait(ready, timeout);
+
+    // Accept incomming connections first since AcceptClients takes the lock itself.
+    std::vector<std::shared_ptr<Sockets::Socket>> accepted;
+    for (const IO::Event& event : ready) {
+        if (event.type == IO::Event::Accept) {
+            AcceptClients();
+        } else if (event.type == IO::Event::Accepted) {
+            // The backend already accepted this client.
+            sockaddr_in client_addr = {0, 0, 0, 0};
+            accepted.push_back(std::make_shared<Sockets::Socket>(event.fd, socket->domain, socket->type, reinterpret_cast<sockaddr&>(client_addr)));
+        } else if (event.type == IO::Event::Wake) {
+            // Clear the wake up.
+            uint64_t value;
+            if (read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                perror("read");
+            }
+        }
+    }
+    if (!accepted.empty()) {
+        RegisterClients(accepted);
+    }
+
+    // Lock mutex so we can use connections.
+    std::lock_guard<std::mutex> lock(sockets_mutex);
+
+    // Close connections that ran out of time.
+    ExpireTimers();
+
+    // Continue connections that were left with buffered requests.
+    std::vector<int> waiting;
+    waiting.swap(pending);
+    for (int fd : waiting) {
+        HTTP::Servers::Connection* connection = FindConnection(fd);
+        if (!connection) {
+            continue;
+        }
+        HTTP::Servers::ConnectionState before = connection->state;
+        try {
+            // Carry on reading a socket the last read left data on, unless reading is paused or no more requests are wanted yet.
+            if (connection->unread && !connection->reading_paused && connection->state != HTTP::Servers::ConnectionState::Writing && connection->state != HTTP::Servers::ConnectionState::Closing) {
+                ReadConnection(*connection);
+            }
+            AdvanceConnection(*connection, completed);
+            UpdateBackpressure(*connection);
+        } catch (const std::runtime_error& e) {
+            connection->state = HTTP::Servers::ConnectionState::Closing;
+        }
+        if (connection->state == HTTP::Servers::ConnectionState::Closing) {
+            CloseConnection(fd);
+        } else if (connection->state != before || connection->state == HTTP::Servers::ConnectionState::ReadingBody) {
+            ArmTimer(*connection);
+        }
+    }
+
+    // Loop over every client event.
+    for (const IO::Event& event : ready) {
+        if (event.type != IO::Event::Accept && event.type != IO::Event::Accepted && event.type != IO::Event::Wake) {
+            HandleEvent(event, completed);
+        }
+    }
+}
+
+void HTTP::Servers::HTTPServer::HandleEvent(const IO::Event& event, std::vector<std::unique_ptr<HTTP::Servers::Data>>& completed) {
+    // Find the connection for this fd.
+    HTTP::Servers::Connection* connection = FindConnection(event.fd);
+    if (!connection) {
+        // Give back buffers for clients that are gone.
+        if (event.type == IO::Event::Data) {
+            backend->ReleaseBuffer(event.buffer_id);
+        }
+        // A closing send whose linked close was cancelled leaves the fd open for us to close.
+        if (event.type == IO::Event::Sent && event.result < 0) {
+            backend->RemoveClient(event.fd);
+            close(event.fd);
+        }
+        return;
+    }
+    HTTP::Servers::ConnectionState before = connection->state;
+
+    try {
+        switch (event.type) {
+            case IO::Event::Readable:
+                // Read what is waiting, anything past the limit is read from pending since edge-triggered epoll won't report it again. An event from before a pause is left for the resume to report again.
+                if (!connection->reading_paused) {
+                    ReadConnection(*connection);
+                }
+                break;
+            case IO::Event::Data:
+                // Copy out of the backend's buffer and give it straight back.
+                connection->input.Append(event.data, event.result);
+                backend->ReleaseBuffer(event.buffer_id);
+                break;
+            case IO::Event::Writable:
+                // Continue writing a response the socket couldn't take before.
+                if (!connection->output.empty()) {
+                    FlushConnection(*connection);
+                }
+                break;
+            case IO::Event::Sent:
+                // The backend finished a send.
+                connection->send_in_flight = false;
+                if (event.result < 0) {
+                    connection->close_sent = false;
+                    connection->state = HTTP::Servers::ConnectionState::Closing;
+                    break;
+                }
+                consume_output(*connection, event.result);
+                if (connection->close_sent && connection->output.empty()) {
+                    // The backend is shutting down and closing the socket.
+                    connection->state = HTTP::Servers::ConnectionState::Closing;
+                    break;
+                }
+                // A short send breaks the linked close, so carry on as normal unless the connection timed out.
+                connection->close_sent = false;
+                if (connection->state != HTTP::Servers::ConnectionState::Closing) {
+                    FlushConnection(*connection);
+                }
+                break;
+            case IO::Event::Hangup:
+                // The other side shut down, or the connection broke.
+                if (event.result < 0) {
+                    connection->state = HTTP::Servers::ConnectionState::Closing;
+                } else {
+                    connection->peer_closed = true;
+                }
+                break;
+            default:
+                break;
+        }
+
+        // Move the state machine forward with the new data, then check if reading should pause or resume.
+        AdvanceConnection(*connection, completed);
+        UpdateBackpressure(*connection);
+    } catch (const std::runtime_error& e) {
+        // Socket errors end the connection.
+        connection->state = HTTP::Servers::ConnectionState::Closing;
+    }
+
+    // Close connections that are finished, otherwise move the deadline if the state changed or more of the body arrived.
+    if (connection->state == HTTP::Servers::ConnectionState::Closing) {
+        CloseConnection(event.fd);
+    } else if (connection->state != before || connection->state == HTTP::Servers::ConnectionState::ReadingBody) {
+        ArmTimer(*connection);
+    }
+}
+
+void HTTP::Servers::HTTPServer::AdvanceConnection(HTTP::Servers::Connection& connection, std::vector<std::unique_ptr<HTTP::Servers::Data>>& completed) {
+    // Keep stepping until the connection needs more data or a response.
+    while (true) {
+        switch (connection.state) {
+            case HTTP::Servers::ConnectionState::Idle:
+                // Start reading a new request as soon as any of it has arrived.
+                if (connection.input.empty()) {
+                    // Give the buffer back while the connection waits.
+                    connection.input.Release();
+                    if (connection.peer_closed) {
+                        stop_reading(connection);
+                    }
+                    return;
+                }
+                connection.state = HTTP::Servers::ConnectionState::ReadingHeaders;
+                connection.request_start = Timers::Now();
+                connection.parser.Reset();
+                break;
+            case HTTP::Servers::ConnectionState::ReadingHeaders: {
+                // Wait for the blank line that ends the headers, parsing only what arrived since last time.
+                HTTP::Requests::RequestView view;
+                size_t header_end;
+                bool supported = true;
+                try {
+                    header_end = connection.parser.Parse(connection.input.view(), view);
+                    if (header_end != 0) {
+                        // Canonicalize the target in the buffer, then work out how the body is framed.
+                        HTTP::Requests::NormalizeTarget(connection.input.data(), view);
+                        supported = HTTP::Requests::StartBody(view, connection.body_decoder);
+                    }
+                } catch (const std::invalid_argument& e) {
+                    // Answer malformed requests with a 400 and close.
+                    RejectRequest(connection, 400);
+                    return;
+                }
+                if ((header_end == 0 && connection.input.size() >= config.max_header_size) || header_end > config.max_header_size) {
+                    // Headers are too big, answer with a 431 and close.
+                    RejectRequest(connection, 431);
+                    return;
+                }
+                if (header_end == 0) {
+                    if (connection.peer_closed) {
+                        stop_reading(connection);
+                    }
+                    return;
+                }
+                if (!supported) {
+                    // Only chunked transfer-encoding is understood.
+                    RejectRequest(connection, 501);
+                    return;
+                }
+
+                // HTTP/1.1 stays open unless told to close, HTTP/1.0 closes unless told to stay open.
+                std::string_view options = view.get_header(HTTP::Requests::KnownHeader::Connection);
+                if (contains_token(options, "close")) {
+                    connection.keep_alive = false;
+                } else {
+                    connection.keep_alive = view.version != "HTTP/1.0" || contains_token(options, "keep-alive");
+                }
+
+                // Copy the headers out so the body can be read through the buffer after them.
+                connection.request = std::make_unique<HTTP::Requests::HTTPRequest>(view, std::string_view());
+                connection.input.Consume(header_end);
+
+                // Check the body against the limit of the route it is for.
+                if (!connection.body_decoder.done()) {
+                    HTTP::Responses::Node* route = response_builder.route(connection.request->url);
+                    connection.max_body_size = route && route->max_body_size != 0 ? route->max_body_size : config.max_body_size;
+                    if (!connection.body_decoder.is_chunked() && connection.body_decoder.get_remaining() > connection.max_body_size) {
+                        // A fixed length can be turned away before any of it is read.
+                        RejectRequest(connection, 413);
+                        return;
+                    }
+                }
+                connection.state = HTTP::Servers::ConnectionState::ReadingBody;
+                break;
+            }
+            case HTTP::Servers::ConnectionState::ReadingBody: {
+                // Decode as much of the body as has arrived, moving it out of the input buffer.
+                try {
+                    while (!connection.body_decoder.done()) {
+                        std::string_view chunk;
+                        size_t consumed = connection.body_decoder.Decode(connection.input.view(), chunk);
+                        if (connection.body_decoder.get_decoded() > connection.max_body_size) {
+                            RejectRequest(connection, 413);
+                            return;
+                        }
+                        if (!chunk.empty()) {
+                            if (!connection.body) {
+                                connection.body = std::make_shared<HTTP::Requests::RequestBody>(config.body_spill_threshold, config.temp_directory);
+                            }
+                            connection.body->Append(chunk);
+                        }
+                        connection.input.Consume(consumed);
+                        if (consumed == 0) {
+                            break;
+                        }
+                    }
+                } catch (const std::invalid_argument& e) {
+                    // Answer malformed chunks with a 400 and close.
+                    RejectRequest(connection, 400);
+                    return;
+                } catch (const std::runtime_error& e) {
+                    // The body couldn't be stored.
+                    RejectRequest(connection, 500);
+                    return;
+                }
+
+                // Wait for the rest of the body.
+                if (!connection.body_decoder.done()) {
+                    if (connection.peer_closed) {
+                        stop_reading(connection);
+                    }
+                    return;
+                }
+
+                // Attach the body and hand the request out for a response.
+                if (connection.body && connection.body->spilled()) {
+                    connection.request->body_file = connection.body;
+                } else if (connection.body) {
+                    connection.request->body = std::move(connection.body->memory);
+                }
+                connection.body.reset();
+                completed.push_back(std::make_unique<HTTP::Servers::Data>(connection.client->get_fd(), connection.client, std::move(*connection.request), connection.next_sequence++));
+                connection.request.reset();
+
+                // Stop at a request that closes the connection or once too many are waiting, otherwise read the next one already buffered.
+                if (!connection.keep_alive || connection.next_sequence - connection.next_response >= config.max_pipeline_depth) {
+                    connection.state = HTTP::Servers::ConnectionState::Writing;
+                    return;
+                }
+                connection.state = HTTP::Servers::ConnectionState::Idle;
+                break;
+            }
+            case HTTP::Servers::ConnectionState::Writing:
+            case HTTP::Servers::ConnectionState::Closing:
+                // Nothing to do until the responses are written.
+                return;
+        }
+    }
+}
 
-        // Insert into temporarary hashmap for ease of use.
-        urls.insert(std::make_pair(parent_url + url_part, node));
+void HTTP::Servers::HTTPServer::QueueOutput(HTTP::Servers::Connection& connection, HTTP::Servers::OutputSegment segment) {
+    // Count memory segments towards the high-water mark, files are sent from the page cache.
+    if (!segment.file) {
+        connection.output_bytes += segment.bytes().size();
     }
+    connection.output.push_back(std::move(segment));
 }
 
-HTTP::Responses::ResponseBuilder::ResponseBuilder(const HTTP::Responses::ResponseBuilder& other) {
-    // Copy data from other into this.
-    this->filename = other.filename;
-    this->file = std::ifstream(other.filename);
-    this->tree = other.tree;
-}
+void HTTP::Servers::HTTPServer::QueueResponse(HTTP::Servers::Connection& connection, uint64_t sequence, HTTP::Responses::HTTPResponse& response) {
+    // Check the request is still waiting for a response.
+    if (sequence < connection.next_response || sequence >= connection.next_sequence || connection.held.count(sequence) != 0) {
+        throw std::invalid_argument("No request waiting for response " + std::to_string(sequence));
+    }
 
-static std::pair<std::string, std::string> split_url(const std::string& url) {
-    // Initialize varaibles for loop.
-    std::string host;
-    std::string route;
-    std::istringstream iss(url);
+    // Tell the client if the connection will be closed after this response.
+    if (!connection.keep_alive && sequence + 1 == connection.next_sequence) {
+        response.keep_alive = false;
+    }
 
-    // Extract host
-    std::getline(iss, host, '/');
-    // Rest is route.
-    if (std::getline(iss, route)) {
-        // Add to route.
-        route = route.substr(0, route.size());
-        if (route.back() == '/') {
-            route.pop_back();
-        }
-        route.erase(route.find_last_not_of(' ') + 1);
-    } else {
-        route = "";
+    // Keep the head and body as separate buffers so the body isn't copied.
+    std::vector<HTTP::Servers::OutputSegment> segments;
+    segments.push_back(HTTP::Servers::OutputSegment{response.get_head()});
+    if (response.file) {
+        segments.push_back(HTTP::Servers::OutputSegment{std::string(), response.file, 0, response.file->length});
+    } else if (response.cached) {
+        // Share the cached bytes, keeping the entry alive until they are written.
+        segments.push_back(HTTP::Servers::OutputSegment{std::string(), nullptr, 0, 0, response.cached, response.encoding});
+    } else if (!response.body.empty()) {
+        segments.push_back(HTTP::Servers::OutputSegment{std::move(response.body)});
     }
 
-    // If route is empty put in a /
-    if (route.empty()) {
-        route = "/";
+    // Hold it back until every earlier response is out.
+    if (sequence != connection.next_response) {
+        connection.held.emplace(sequence, std::move(segments));
+        return;
     }
 
-    return std::make_pair(host, route);
+    // Queue it, then any held responses that were only waiting on it.
+    for (HTTP::Servers::OutputSegment& segment : segments) {
+        QueueOutput(connection, std::move(segment));
+    }
+    connection.next_response++;
+    while (!connection.held.empty() && connection.held.begin()->first == connection.next_response) {
+        for (HTTP::Servers::OutputSegment& segment : connection.held.begin()->second) {
+            QueueOutput(connection, std::move(segment));
+        }
+        connection.held.erase(connection.held.begin());
+        connection.next_response++;
+    }
 }
 
-static std::vector<std::string> split_route(const std::string& str) {
-    // Initialize variables for loop.
-    std::vector<std::string> result;
-    std::istringstream iss(str);
+void HTTP::Servers::HTTPServer::FinishWrite(int fd) {
+    // Find the connection.
+    HTTP::Servers::Connection* connection = FindConnection(fd);
+    if (!connection) {
+        return;
+    }
 
-    // Loop over every / and add to route.
-    std::string token;
-    while (std::getline(iss, token, '/')) {
-        result.push_back(token);
+    // Send what the socket can take now, the rest goes out on EPOLLOUT.
+    try {
+        FlushConnection(*connection);
+        UpdateBackpressure(*connection);
+    } catch (const std::runtime_error& e) {
+        connection->state = HTTP::Servers::ConnectionState::Closing;
     }
 
-    return result;
+    // Close if the last response is out, otherwise move the deadline if the connection is reading again.
+    if (connection->state == HTTP::Servers::ConnectionState::Closing) {
+        CloseConnection(fd);
+    } else if (connection->state != HTTP::Servers::ConnectionState::Writing) {
+        ArmTimer(*connection);
+    }
 }
 
-HTTP::Responses::HTTPResponse HTTP::Responses::ResponseBuilder::build(HTTP::Requests::HTTPRequest& request) {
-    // Initialize template OK response.
-    HTTP::Responses::HTTPResponse response(200, std::map<std::string,std::string>({{"Content-Type", "text/html"}, {"Connection", "keep-alive"}}), "");
+void HTTP::Servers::HTTPServer::RejectRequest(HTTP::Servers::Connection& connection, int status) {
+    // Stop reading and answer after the requests before this one.
+    connection.state = HTTP::Servers::ConnectionState::Writing;
+    connection.keep_alive = false;
+    connection.request.reset();
+    connection.body.reset();
+    HTTP::Responses::HTTPResponse response(status, std::map<std::string,std::string>(), "");
+    QueueResponse(connection, connection.next_sequence++, response);
+    FlushConnection(connection);
+}
 
-    // Extract url.
-    std::pair<std::string,std::string> url = split_url(request.url);
+void HTTP::Servers::HTTPServer::UpdateBackpressure(HTTP::Servers::Connection& connection) {
+    // Too many requests waiting on responses also stops reading, as does more than a header block of requests read but not parsed yet, otherwise a client pipelining without reading its responses fills the input buffer.
+    bool pipeline_full = connection.next_sequence - connection.next_response >= config.max_pipeline_depth || (connection.state != HTTP::Servers::ConnectionState::ReadingBody && connection.input.size() > config.max_header_size);
+    if (!connection.reading_paused && (connection.output_bytes >= config.output_high_water || pipeline_full)) {
+        // The client isn't keeping up, stop reading more requests from it.
+        connection.reading_paused = true;
+        backend->PauseReading(connection.client->get_fd());
+    } else if (connection.reading_paused && connection.output_bytes <= config.output_high_water / 2 && !pipeline_full) {
+        // Enough has drained, read again.
+        connection.reading_paused = false;
+        backend->ResumeReading(connection.client->get_fd());
+    }
+}
 
-    // Check if the url is found.
-    if (url.first != tree->url_part) {
-        response.status = 404;
-        response.body = "<!DOCTYPE html><html><head><title>Error</title></head><body><h1>An error ocurred</h1><p>The url in request is different to the url of this site</p></body></html>";
-        response.headers.insert(std::make_pair("Content-Length", std::to_string(response.body.size())));
-        return response;
+void HTTP::Servers::HTTPServer::FlushConnection(HTTP::Servers::Connection& connection) {
+    // Output can't change while the backend is sending it.
+    if (connection.send_in_flight) {
+        return;
     }
 
-    // Extract routes from url.
-    std::vector<std::string> routes = split_route(url.second);
+    // Write segments until they are all sent or the socket is full.
+    while (!connection.output.empty()) {
+        // Send file segments straight from the page cache.
+        HTTP::Servers::OutputSegment& front = connection.output.front();
+        if (front.file) {
+            size_t sent = socket->SendFileAvailable(*connection.client, front.file->fd, front.file_offset + connection.output_offset, front.file_length - connection.output_offset);
+            connection.output_offset += sent;
+            if (connection.output_offset < front.file_length) {
+                // Socket is full, resume once it is writable.
+                backend->WatchWritable(connection.client->get_fd());
+                return;
+            }
+            connection.output.pop_front();
+            connection.output_offset = 0;
+            continue;
+        }
 
-    // Loop over tokens in routes and go down the tree.
-    Node* current = tree.get();
-    for (const auto& token : routes) {
-        for (std::shared_ptr<Node> node : current->children) {
-            if (node->url_part == ('/' + token) || node->url_part == token) {
-                current = node.get();
+        // Gather the memory segments up to the next file, skipping what was already sent from the first one.
+        iovec iov[64];
+        int iovcnt = 0;
+        size_t total = 0;
+        bool more = false;
+        for (auto it = connection.output.begin(); it != connection.output.end() && iovcnt < 64; it++) {
+            if (it->file) {
+                // Hold back the last packet since the file follows straight after.
+                more = true;
                 break;
             }
+            size_t skip = (iovcnt == 0) ? connection.output_offset : 0;
+            std::string_view bytes = it->bytes();
+            iov[iovcnt].iov_base = const_cast<char*>(bytes.data()) + skip;
+            iov[iovcnt].iov_len = bytes.size() - skip;
+            total += iov[iovcnt].iov_len;
+            iovcnt++;
         }
-    }
 
-    // Read data from node in tree found.
-    std::ifstream file(current->file_path);
-    std::string html;
-    std::string line;
-    while (std::getline(file, line)) {
-        html += line + "\n";
-    }
-    file.close();
+        // Let the backend send if it can, linking the close when this is the last output of a closing connection.
+        if (backend->SendsAsync()) {
+            bool last = !more && static_cast<size_t>(iovcnt) == connection.output.size() && connection.state == HTTP::Servers::ConnectionState::Writing && !connection.keep_alive && connection.next_response == connection.next_sequence;
+            backend->Send(connection.client->get_fd(), iov, iovcnt, last);
+            connection.send_in_flight = true;
+            connection.close_sent = last;
+            return;
+        }
 
-    // Write data into response.
-    response.body = html;
-    response.headers.insert(std::make_pair("Content-Length", std::to_string(response.body.size())));
+        // Send them with one call.
+        size_t sent = socket->SendVAvailable(*connection.client, iov, iovcnt, more);
+        consume_output(connection, sent);
 
-    return response;
-}
+        // Stop if the socket couldn't take everything, EPOLLOUT will resume.
+        if (sent < total) {
+            return;
+        }
+    }
+    connection.output_offset = 0;
 
-HTTP::Responses::ResponseBuilder& HTTP::Responses::ResponseBuilder::operator=(const HTTP::Responses::ResponseBuilder& other) {
-    // Check if we are copying a variable into itself.
-    if (this == &other) {
-        return *this;
+    // Close once the last response is out, or go back to reading once the requests waiting on responses are under the limit.
+    if (connection.state == HTTP::Servers::ConnectionState::Writing) {
+        if (!connection.keep_alive) {
+            if (connection.next_response == connection.next_sequence) {
+                connection.state = HTTP::Servers::ConnectionState::Closing;
+            }
+        } else if (connection.next_sequence - connection.next_response < config.max_pipeline_depth) {
+            connection.state = HTTP::Servers::ConnectionState::Idle;
+            // Requests already buffered or left on the socket won't get another epoll event so queue them up.
+            if (!connection.input.empty() || connection.peer_closed || connection.unread) {
+                pending.push_back(connection.client->get_fd());
+            }
+        }
+    } else if (connection.state == HTTP::Servers::ConnectionState::Idle && !awaiting_responses(connection)) {
+        // The keep-alive time starts once every response is written.
+        ArmTimer(connection);
     }
-    // Copy data from other into this.
-    this->filename = other.filename;
-    this->file = std::ifstream(other.filename);
-    this->tree = other.tree;
-    return *this;
 }
 
-HTTP::Responses::ResponseBuilder::~ResponseBuilder() {
-    // Close file to clean resources.
-    file.close();
-    return;
-}
+void HTTP::Servers::HTTPServer::ReadConnection(HTTP::Servers::Connection& connection) {
+    // A few spill-sized chunks at a time, so a fast upload is decoded and spilled between reads instead of landing in the input buffer whole.
+    size_t limit = std::max<size_t>(config.body_spill_threshold, 4096) * 4;
 
-HTTP::Servers::HTTPServer::HTTPServer(std::string website_tree_filename) {
-    // Initialize response builder.
-    this->response_builder = HTTP::Responses::ResponseBuilder(website_tree_filename);
-    // Initialize address for socket.
-    sockaddr_in addr = {0, 0, 0, 0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(8080); // Change to port 80 later.
-    inet_pton(AF_INET, "0.0.0.0", &addr.sin_addr);
-    // Create socket.
-    std::unique_ptr<Sockets::Socket> server = std::make_unique<Sockets::Socket>(AF_INET, SOCK_STREAM, reinterpret_cast<sockaddr&>(addr));
-    server->Bind();
-    server->Listen(1);
-    this->socket = std::move(server);
-    // Start thread for accepting clients.
-    StartAcceptThread();
+    // Headers are read no further than one byte past the largest allowed, which is enough to answer 431 without growing the buffer more.
+    if (connection.state == HTTP::Servers::ConnectionState::Idle || connection.state == HTTP::Servers::ConnectionState::ReadingHeaders) {
+        limit = std::min(limit, config.max_header_size + 1 - std::min(connection.input.size(), config.max_header_size));
+    }
+    bool closed = false;
+    size_t read = socket->RecvAvailable(*connection.client, connection.input, closed, limit);
+    connection.peer_closed = connection.peer_closed || closed;
+
+    // Come back for the rest next loop since edge-triggered epoll won't report it again.
+    connection.unread = !closed && read >= limit;
+    if (connection.unread) {
+        pending.push_back(connection.client->get_fd());
+    }
 }
 
-HTTP::Servers::HTTPServer::~HTTPServer() {
-    // Stop running so accept thread knows to stop.
-    this->running = 0;
+void HTTP::Servers::HTTPServer::ArmTimer(HTTP::Servers::Connection& connection) {
+    // Work out the deadline for the state, no stage of a request can go past the whole request's deadline.
+    uint64_t now = Timers::Now();
+    uint64_t request_deadline = connection.request_start + config.request_timeout;
+    switch (connection.state) {
+        case HTTP::Servers::ConnectionState::Idle:
+            // Responses still going out are held to the deadline of the request they answer.
+            timers.Arm(connection.timer, awaiting_responses(connection) ? request_deadline : now + config.keep_alive_timeout);
+            break;
+        case HTTP::Servers::ConnectionState::ReadingHeaders:
+            timers.Arm(connection.timer, std::min(connection.request_start + config.header_timeout, request_deadline));
+            break;
+        case HTTP::Servers::ConnectionState::ReadingBody:
+            timers.Arm(connection.timer, std::min(now + config.body_timeout, request_deadline));
+            break;
+        case HTTP::Servers::ConnectionState::Writing:
+            timers.Arm(connection.timer, request_deadline);
+            break;
+        case HTTP::Servers::ConnectionState::Closing:
+            connection.timer.Cancel();
+            break;
+    }
 }
 
-void HTTP::Servers::HTTPServer::StartAcceptThread() {
-    // Create an epoll_fd.
-    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+void HTTP::Servers::HTTPServer::ExpireTimers() {
+    // Collect every timer that has fired.
+    expired.clear();
+    timers.Advance(Timers::Now(), expired);
 
-    // Add an event to the epoll_fd.
-    epoll_event event;
-    event.events = EPOLLIN;
-    event.data.fd = socket->get_fd();
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket->get_fd(), &event);
-
-    // Define the thread and start it.
-    std::thread accept_thread([this]() {
-        // While the server is running.
-        while (this->running) {
-            // Extract events.
-            int num_events = epoll_wait(this->epoll_fd, this->events, 100, -1);
+    for (Timers::Timer* timer : expired) {
+        // The handling loop's own deadline.
+        if (timer == &run_timer) {
+            run_expired = true;
+            continue;
+        }
 
-            // Check for error.
-            if (num_events == -1) {
-                perror("epoll_wait");
-                continue;
-            }
+        // Find the connection the timer belongs to.
+        HTTP::Servers::Connection* connection = FindConnection(timer->id);
+        if (!connection) {
+            continue;
+        }
+        connection->state = HTTP::Servers::ConnectionState::Closing;
+        CloseConnection(timer->id);
+    }
+}
 
-            // Loop over every event.
-            for (int i = 0; i < num_events; i++) {
-                // If it is an incomming connection, accept.
-                if (this->events[i].data.fd == this->socket->get_fd()) {
-                    AcceptClients();
-                }
-            }
+void HTTP::Servers::HTTPServer::RunClients(std::shared_ptr<bool> stop_flag, int timeout) {
+    // Put the deadline on the wheel so waiting for events wakes up for it.
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        run_expired = false;
+        if (timeout > 0) {
+            timers.Arm(run_timer, Timers::Now() + static_cast<uint64_t>(timeout) * 1000);
         }
-    });
+    }
 
-    // Detach thread since it will stop itself, therefore no need to join.
-    accept_thread.detach();
-}
+    // Loop until the server stops running, the stop flag is set or the timeout is reached.
+    while (this->running && !(stop_flag && *stop_flag) && !run_expired) {
+        // Handle the clients.
+        HandleClientsCycle();
+    }
 
-void HTTP::Servers::HTTPServer::AcceptClients() {
-    // Lock mutex so we can accept sockets.
+    // Take the deadline off the wheel if it didn't fire.
     std::lock_guard<std::mutex> lock(sockets_mutex);
+    run_timer.Cancel();
+}
 
-    // Accept client.
-    std::shared_ptr<Sockets::Socket> client = socket->Accept();
-
-    // Add client to events.
-    epoll_event event;
-    event.events = EPOLLIN;
-    event.data.fd = client->get_fd();
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->get_fd(), &event);
+HTTP::Servers::Connection* HTTP::Servers::HTTPServer::FindConnection(int fd) {
+    // The connection lives in the slot for its fd.
+    if (fd < 0 || static_cast<size_t>(fd) >= connections.size()) {
+        return nullptr;
+    }
+    return connections[fd].get();
 }
 
-std::unique_ptr<HTTP::Servers::Data> HTTP::Servers::HTTPServer::ReadClient(int id) {
-    // Lock mutex so we can read data.
-    std::lock_guard<std::mutex> lock(this->sockets_mutex);
+void HTTP::Servers::HTTPServer::CloseConnection(int fd) {
+    // Find the connection.
+    HTTP::Servers::Connection* connection = FindConnection(fd);
+    if (!connection) {
+        return;
+    }
 
-    // Extract client.
-    Sockets::Socket client = *socket->clients.at(id);
+    // A send in flight still points at the output, so fail it and close once it finishes.
+    if (connection->send_in_flight) {
+        connection->state = HTTP::Servers::ConnectionState::Closing;
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
 
-    // Recieve data.
-    std::string recieved = socket->Recv(client);
-    std::unique_ptr<HTTP::Servers::Data> data = std::make_unique<HTTP::Servers::Data>(id, std::make_shared<Sockets::Socket>(client), HTTP::Requests::HTTPRequest(recieved));
+    if (connection->close_sent) {
+        // The backend closes the fd after the last send so just let go of it.
+        connection->client->Release();
+    } else {
+        // Stop watching the fd and shut the socket down now, it is closed once the last reference to it is gone.
+        backend->RemoveClient(fd);
+        shutdown(fd, SHUT_RDWR);
+    }
 
-    return data;
+    // Empty the slot, the connection is destroyed here.
+    connections[fd].reset();
 }
 
-std::unique_ptr<HTTP::Servers::Data> HTTP::Servers::HTTPServer::ReadClient(Sockets::Socket& client) {
-    // Lock mutex so we can read data.
-    std::lock_guard<std::mutex> lock(this->sockets_mutex);
-
-    // Recieve data.
-    std::string recieved = socket->Recv(client);
-
-    // Find client.
-    std::vector<Sockets::Socket> results;
-    for (const auto& element : socket->clients) {
-        results.push_back(*element.get());
+std::unique_ptr<HTTP::Servers::Data> HTTP::Servers::HTTPServer::ReadClient(int id) {
+    // Find the client among the ones the server socket accepted.
+    std::shared_ptr<Sockets::Socket> client;
+    {
+        // Lock mutex so we can read connections.
+        std::lock_guard<std::mutex> lock(this->sockets_mutex);
+
+        // Connections belong to the reactor, reading them here would race it for their data.
+        if (FindConnection(id)) {
+            throw std::invalid_argument("Client " + std::to_string(id) + " is read by the reactor, use ReadClients");
+        }
+        auto it = std::find_if(socket->clients.begin(), socket->clients.end(), [id](const std::shared_ptr<Sockets::Socket>& element) { return element->get_fd() == id; });
+        if (it == socket->clients.end()) {
+            throw std::out_of_range("No client with id " + std::to_string(id));
+        }
+        client = *it;
     }
 
-    auto it = std::find(results.begin(), results.end(), client);
-    int id = std::distance(results.begin(), it);
+    // Recieve a whole request without holding the lock, the reactor keeps running while this waits. The buffer comes from a pool of its own since the server's isn't thread-safe.
+    Buffers::SlabPool pool;
+    Buffers::RecvBuffer input(pool);
+    HTTP::Requests::RequestParser parser;
+    return std::make_unique<HTTP::Servers::Data>(id, client, read_request(*socket, *client, input, parser, config));
+}
 
-    for (size_t i = 0; i < results.size(); i++) {
-        *socket->clients[i] = results[i];
+std::unique_ptr<HTTP::Servers::Data> HTTP::Servers::HTTPServer::ReadClient(Sockets::Socket& client) {
+    // Find the shared pointer to the client from the clients the server socket accepted.
+    int id = client.get_fd();
+    std::shared_ptr<Sockets::Socket> shared;
+    {
+        // Lock mutex so we can read connections.
+        std::lock_guard<std::mutex> lock(this->sockets_mutex);
+
+        // Connections belong to the reactor, reading them here would race it for their data.
+        if (FindConnection(id)) {
+            throw std::invalid_argument("Client " + std::to_string(id) + " is read by the reactor, use ReadClients");
+        }
+        auto it = std::find_if(socket->clients.begin(), socket->clients.end(), [&client](const std::shared_ptr<Sockets::Socket>& element) { return element.get() == &client; });
+        if (it == socket->clients.end()) {
+            throw std::out_of_range("Client was not accepted by this server");
+        }
+        shared = *it;
     }
 
-    // Convert message to Data struct.
-    std::unique_ptr<HTTP::Servers::Data> data = std::make_unique<HTTP::Servers::Data>(id, std::make_shared<Sockets::Socket>(client), HTTP::Requests::HTTPRequest(recieved));
-
-    return data;
+    // Recieve a whole request without holding the lock, the reactor keeps running while this waits. The buffer comes from a pool of its own since the server's isn't thread-safe.
+    Buffers::SlabPool pool;
+    Buffers::RecvBuffer input(pool);
+    HTTP::Requests::RequestParser parser;
+    return std::make_unique<HTTP::Servers::Data>(id, shared, read_request(*socket, client, input, parser, config));
 }
 
 std::vector<std::unique_ptr<HTTP::Servers::Data>> HTTP::Servers::HTTPServer::ReadClients() {
-    // Wait for events.
-    int num_events = epoll_wait(epoll_fd, events, 100, -1);
-
-    // Check for error.
-    if (num_events == -1) {
-        perror("epoll_wait");
-        return {};
-    }
-
     // Create a vector to hold all requests.
     std::vector<std::unique_ptr<HTTP::Servers::Data>> requests;
 
-    // Loop over every event.
-    for (int i = 0; i < num_events; i++) {
-        // Check if we can read.
-        if (events[i].data.fd == socket->get_fd()) {
-            // Skip incomming connections.
-            continue;
-        } else {
-            // Handle client socket events
-            int client_fd = events[i].data.fd;
-            std::shared_ptr<Sockets::Socket> client = socket->clients[i];
-            if (events[i].events & EPOLLIN) {
-                // Lock mutex so we can recieve data.
-                std::lock_guard<std::mutex> lock(sockets_mutex);
+    // Move every ready connection forward and collect finished requests.
+    PollClients(requests);
 
-                // Recieve data.
-                std::string received = socket->Recv(*client);
-                std::unique_ptr<HTTP::Servers::Data> data = std::make_unique<HTTP::Servers::Data>(client_fd, client, HTTP::Requests::HTTPRequest(received));
-                
-                // Add data to results.
-                requests.push_back(std::move(data));
-            }
+    return requests;
+}
+
+int HTTP::Servers::HTTPServer::WriteClient(int id, HTTP::Requests::HTTPRequest& request) {
+    // Extract client.
+    std::shared_ptr<Sockets::Socket> client;
+    {
+        // Lock mutex so we can read connections.
+        std::lock_guard<std::mutex> lock(this->sockets_mutex);
+        HTTP::Servers::Connection* connection = FindConnection(id);
+        if (!connection) {
+            throw std::out_of_range("No client with id " + std::to_string(id));
         }
+        client = connection->client;
     }
 
-    return requests;
+    // Write to client.
+    return WriteClient(*client, request);
 }
 
-int HTTP::Servers::HTTPServer::WriteClient(int id, HTTP::Requests::HTTPRequest& request) {
+int HTTP::Servers::HTTPServer::WriteClient(Sockets::Socket& client, HTTP::Requests::HTTPRequest& request) {
     // Lock mutex so we can write data.
     std::lock_guard<std::mutex> lock(this->sockets_mutex);
 
-    // Build a repsonse from the request.
+    // Build a response from the request.
     HTTP::Responses::HTTPResponse response = response_builder.build(request);
 
-    // Extract client.
-    Sockets::Socket client = *socket->clients.at(id);
+    // If the client isn't a reactor connection send the response blocking.
+    HTTP::Servers::Connection* connection = FindConnection(client.get_fd());
+    if (!connection || connection->client.get() != &client) {
+        return send_blocking(*socket, client, response);
+    }
 
-    // Send response.
-    std::string send = response.toString();
-    int res = socket->Send(client, send);
+    // Answer the oldest request that doesn't have a response yet.
+    uint64_t sequence = connection->next_response;
+    while (connection->held.count(sequence) != 0) {
+        sequence++;
+    }
+    QueueResponse(*connection, sequence, response);
+    FinishWrite(client.get_fd());
 
-    return res;
+    return 0;
 }
 
-int HTTP::Servers::HTTPServer::WriteClient(Sockets::Socket& client, HTTP::Requests::HTTPRequest& request) {
+int HTTP::Servers::HTTPServer::WriteClient(HTTP::Servers::Data& data) {
     // Lock mutex so we can write data.
     std::lock_guard<std::mutex> lock(this->sockets_mutex);
 
     // Build a response from the request.
-    HTTP::Responses::HTTPResponse response = response_builder.build(request);
+    HTTP::Responses::HTTPResponse response = response_builder.build(data.request);
+
+    // If the client isn't a reactor connection send the response blocking.
+    HTTP::Servers::Connection* connection = FindConnection(data.id);
+    if (!connection || connection->client != data.client) {
+        return send_blocking(*socket, *data.client, response);
+    }
 
-    // Send response.
-    std::string send = response.toString();
-    int res = socket->Send(client, send);
+    // Put the response in its place and send what is ready.
+    QueueResponse(*connection, data.sequence, response);
+    FinishWrite(data.id);
 
-    return res;
+    return 0;
+}
+
+int HTTP::Servers::HTTPServer::WriteClients(std::vector<std::unique_ptr<HTTP::Servers::Data>>& data) {
+    // Lock mutex so we can write data.
+    std::lock_guard<std::mutex> lock(this->sockets_mutex);
+
+    // Queue every response first so a connection's pipelined responses can go out in one write.
+    std::vector<int> written;
+    for (std::unique_ptr<HTTP::Servers::Data>& element : data) {
+        HTTP::Responses::HTTPResponse response = response_builder.build(element->request);
+        HTTP::Servers::Connection* connection = FindConnection(element->id);
+        if (!connection || connection->client != element->client) {
+            send_blocking(*socket, *element->client, response);
+            continue;
+        }
+        QueueResponse(*connection, element->sequence, response);
+        written.push_back(element->id);
+    }
+
+    // Flush each connection once.
+    std::sort(written.begin(), written.end());
+    written.erase(std::unique(written.begin(), written.end()), written.end());
+    for (int fd : written) {
+        FinishWrite(fd);
+    }
+
+    return 0;
 }
 
 int HTTP::Servers::HTTPServer::HandleClientCycle(int id) {
@@ -643,7 +2777,7 @@ int HTTP::Servers::HTTPServer::HandleClientCycle(int id) {
     std::unique_ptr<HTTP::Servers::Data> data_read = ReadClient(id);
     
     // Write data back.
-    return WriteClient(*data_read->client, data_read->request);
+    return WriteClient(*data_read);
 }
 
 int HTTP::Servers::HTTPServer::HandleClientCycle(Sockets::Socket& client) {
@@ -651,59 +2785,26 @@ int HTTP::Servers::HTTPServer::HandleClientCycle(Sockets::Socket& client) {
     std::unique_ptr<HTTP::Servers::Data> data_read = ReadClient(client);
 
     // Write data back.
-    return WriteClient(client, data_read->request);
+    return WriteClient(*data_read);
 }
 
 int HTTP::Servers::HTTPServer::HandleClientsCycle() {
     // Read all clients.
     std::vector<std::unique_ptr<HTTP::Servers::Data>> read = ReadClients();
 
-    // Loop over every one and write back.
-    for (size_t i = 0; i < read.size(); i++) {
-        WriteClient(*read[i]->client, read[i]->request);
-    }
-
-    return 0;
+    // Write back to every one.
+    return WriteClients(read);
 }
 
 std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(int id, std::shared_ptr<bool> stop_flag, int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
-    }
-
     // Start a thread to handle a client.
-    std::thread thread([this,id,stop_flag,timeout_reached,timeout_mutex]() {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
+    std::thread thread([this,id,stop_flag,timeout]() {
+        // Work out when to stop.
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
         // Loop until the server stops running, the stop flag is triggered or the timeout is reached.
-        while (this->running && *stop_flag == 0 && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
-
+        while (this->running && *stop_flag == 0 && (timeout <= 0 || std::chrono::steady_clock::now() < deadline)) {
             // Handle the client.
             HandleClientCycle(id);
-
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
         }
     });
 
@@ -712,42 +2813,19 @@ std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(int id, std::shar
 }
 
 std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(int id, int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
-    }
+    // Handle the client with a flag that is never set.
+    return StartClientHandleThread(id, std::make_shared<bool>(false), timeout);
+}
 
+std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(std::shared_ptr<Sockets::Socket> client, std::shared_ptr<bool> stop_flag, int timeout) {
     // Start a thread to handle a client.
-    std::thread thread([this,id,timeout_reached,timeout_mutex]() {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
-        // Loop until the server stops running or the timeout is reached.
-        while (this->running && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
-
+    std::thread thread([this,client,stop_flag,timeout]() {
+        // Work out when to stop.
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+        // Loop until the server stops running, stop flag is set or the timeout is reached.
+        while (this->running && *stop_flag == 0 && (timeout <= 0 || std::chrono::steady_clock::now() < deadline)) {
             // Handle the client.
-            HandleClientCycle(id);
-
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
+            HandleClientCycle(*client);
         }
     });
 
@@ -755,216 +2833,271 @@ std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(int id, int timeo
     return thread;
 }
 
-std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(std::shared_ptr<Sockets::Socket> client, std::shared_ptr<bool> stop_flag, int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
-    }
+std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(std::shared_ptr<Sockets::Socket> client, int timeout) {
+    // Handle the client with a flag that is never set.
+    return StartClientHandleThread(client, std::make_shared<bool>(false), timeout);
+}
 
-    // Start a thread to handle a client.
-    std::thread thread([this,client=std::dynamic_pointer_cast<Sockets::Socket>(client),stop_flag,timeout_reached,timeout_mutex]() {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
-        // Loop until the server stops running, stop flag is set or the timeout is reached.
-        while (this->running && *stop_flag == 0 && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
+std::thread HTTP::Servers::HTTPServer::StartClientsHandleThread(std::shared_ptr<bool> stop_flag, int timeout) {
+    // Start a thread to handle clients.
+    std::thread thread([this,stop_flag,timeout]() {
+        RunClients(stop_flag, timeout);
+    });
 
-            // Handle the client.
-            HandleClientCycle(*client);
+    // Return thread so user can join, detach etc.
+    return thread;
+}
 
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
-        }
+std::thread HTTP::Servers::HTTPServer::StartClientsHandleThread(int timeout) {
+    // Start a thread to handle clients.
+    std::thread thread([this,timeout]() {
+        RunClients(nullptr, timeout);
     });
 
     // Return thread so user can join, detach etc.
     return thread;
 }
 
-std::thread HTTP::Servers::HTTPServer::StartClientHandleThread(std::shared_ptr<Sockets::Socket> client, int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
+void HTTP::Servers::HTTPServer::HandleClients(int timeout) {
+    // Handle clients on this thread.
+    RunClients(nullptr, timeout);
+}
+
+HTTP::Servers::HTTPServerPool::HTTPServerPool(std::string website_tree_filename, HTTP::Servers::ServerConfig config, int workers, bool cpu_steering) {
+    // Default to one worker per core.
+    if (workers <= 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
     }
+    this->cpu_steering = cpu_steering;
 
-    // Start a thread to handle a client.
-    std::thread thread([this,client=std::dynamic_pointer_cast<Sockets::Socket>(client),timeout_reached,timeout_mutex]() {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
-        // Loop until the server stops running or the timeout is reached.
-        while (this->running && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
+    // Every worker serves from one cache, so hot files are held once rather than once per worker.
+    if (!config.content_cache && config.content_cache_size != 0) {
+        config.content_cache = std::make_shared<Cache::ContentCache>(config.content_cache_size);
+    }
 
-            // Handle the client.
-            HandleClientCycle(*client);
+    // Create every worker with its own listener on the shared port, in order so listener i is index i in the group.
+    config.reuse_port = true;
+    for (int i = 0; i < workers; i++) {
+        servers.push_back(std::make_unique<HTTP::Servers::HTTPServer>(website_tree_filename, config));
+    }
 
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
-        }
-    });
+    // Steer connections to the listener matching the CPU they arrived on.
+    if (cpu_steering) {
+        servers.front()->get_socket().AttachCPUSteering(workers);
+    }
+}
 
-    // Return thread so user can join, detach etc.
-    return thread;
+HTTP::Servers::HTTPServerPool::~HTTPServerPool() {
+    // Stop and join every worker.
+    Stop();
 }
 
-std::thread HTTP::Servers::HTTPServer::StartClientsHandleThread(std::shared_ptr<bool> stop_flag, int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
+void HTTP::Servers::HTTPServerPool::Start(int timeout) {
+    // Check if the workers have already been started.
+    if (!threads.empty()) {
+        return;
+    }
+
+    // Start a thread for every worker.
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < servers.size(); i++) {
+        HTTP::Servers::HTTPServer* server = servers[i].get();
+        threads.emplace_back([server,timeout]() {
+            server->HandleClients(timeout);
         });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
+
+        // Pin the worker to the CPU its listener is steered from.
+        if (cpu_steering) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+        }
     }
+}
 
-    // Start a thread to handle a client.
-    std::thread thread([this,stop_flag,timeout_reached,timeout_mutex] {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
-        // Loop until the server stops running, stop flag is set or the timeout is reached.
-        while (this->running && *stop_flag == 0 && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
+void HTTP::Servers::HTTPServerPool::HandleClients(int timeout) {
+    // Start workers and wait for all of them.
+    Start(timeout);
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads.clear();
+}
 
-            // Handle the clients.
-            HandleClientsCycle();
+void HTTP::Servers::HTTPServerPool::Stop() {
+    // Tell every worker to stop.
+    for (std::unique_ptr<HTTP::Servers::HTTPServer>& server : servers) {
+        server->Stop();
+    }
 
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
+    // Wait for them to finish.
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
         }
-    });
+    }
+    threads.clear();
+}
 
-    // Return thread so user can join, detach etc.
-    return thread;
+size_t HTTP::Servers::HTTPServerPool::size() {
+    // Give number of workers out.
+    return servers.size();
 }
 
-std::thread HTTP::Servers::HTTPServer::StartClientsHandleThread(int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
+HTTP::Clients::HTTPClient::HTTPClient(HTTP::Clients::ClientConfig config) : config(config), buffer_pool(), idle(), stats() {}
+
+std::unique_ptr<HTTP::Clients::ClientConnection> HTTP::Clients::HTTPClient::Acquire(const std::string& ip, int port, bool& reused) {
+    // Take the most recently used idle connection that is still good.
+    reused = false;
+    auto it = idle.find(ip + ":" + std::to_string(port));
+    uint64_t now = Timers::Now();
+    while (it != idle.end() && !it->second.empty()) {
+        std::unique_ptr<HTTP::Clients::ClientConnection> connection = std::move(it->second.back());
+        it->second.pop_back();
+
+        // Anything to read on an idle connection means the server closed it or broke the protocol.
+        pollfd readable = {connection->socket->get_fd(), POLLIN, 0};
+        if (now - connection->idle_since > static_cast<uint64_t>(config.idle_timeout) || poll(&readable, 1, 0) != 0) {
+            continue;
+        }
+        reused = true;
+        stats.reused++;
+        return connection;
     }
 
-    // Start a thread to handle a client.
-    std::thread thread([this,timeout_reached,timeout_mutex]() {
-        // Create a lock
-        std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-        // Lock timeout mutex so we can check.
-        timeout_lock.lock();
-        // Loop until the server stops running or the timeout is reached.
-        while (this->running && timeout_reached == 0) {
-            // Unlock the timeout mutex.
-            timeout_lock.unlock();
-
-            // Handle the clients.
-            HandleClientsCycle();
-
-            // Lock the timeout mutex so we can check.
-            timeout_lock.lock();
+    // Connect a new one.
+    sockaddr_in addr = {0, 0, 0, 0};
+    addr.sin_family = AF_INET;
+    std::unique_ptr<Sockets::Socket> socket = std::make_unique<Sockets::Socket>(AF_INET, SOCK_STREAM, reinterpret_cast<sockaddr&>(addr));
+    socket->Connect(AF_INET, port, ip);
+    stats.connected++;
+    return std::make_unique<HTTP::Clients::ClientConnection>(std::move(socket), buffer_pool);
+}
+
+void HTTP::Clients::HTTPClient::Release(const std::string& key, std::unique_ptr<HTTP::Clients::ClientConnection> connection) {
+    // Close it if there are already enough idle connections to the server.
+    std::vector<std::unique_ptr<HTTP::Clients::ClientConnection>>& connections = idle[key];
+    if (connections.size() >= config.max_idle_per_host) {
+        return;
+    }
+
+    // Give the buffer back while the connection waits.
+    connection->input.Release();
+    connection->idle_since = Timers::Now();
+    connections.push_back(std::move(connection));
+}
+
+HTTP::Responses::HTTPResponse HTTP::Clients::HTTPClient::Exchange(HTTP::Clients::ClientConnection& connection, std::string& raw, bool no_body, bool& responded, bool& keep_alive) {
+    // Send the whole request.
+    Sockets::Socket& socket = *connection.socket;
+    socket.Send(socket, raw);
+
+    // Parse what arrives until the response is complete.
+    HTTP::Responses::ResponseParser parser(no_body);
+    HTTP::Responses::HTTPResponse response(0, std::map<std::string, std::string>(), "");
+    responded = false;
+    keep_alive = false;
+    while (true) {
+        connection.input.Consume(parser.Parse(connection.input.view(), response));
+        if (response.body.size() > config.max_body_size) {
+            throw std::invalid_argument("HTTP response body too large");
+        }
+        if (parser.done()) {
+            break;
         }
-    });
 
-    // Return thread so user can join, detach etc.
-    return thread;
+        // Wait for more of the response.
+        pollfd readable = {socket.get_fd(), POLLIN, 0};
+        int ready = poll(&readable, 1, config.response_timeout);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            throw std::runtime_error("Timed out waiting for HTTP response");
+        }
+        bool closed = false;
+        if (socket.RecvAvailable(socket, connection.input, closed) > 0) {
+            responded = true;
+        }
+
+        // A close ends a body that runs until it, or cuts the response short.
+        if (closed) {
+            if (!responded) {
+                throw std::runtime_error("Connection closed before a HTTP response");
+            }
+            connection.input.Consume(parser.Parse(connection.input.view(), response));
+            if (response.body.size() > config.max_body_size) {
+                throw std::invalid_argument("HTTP response body too large");
+            }
+            parser.Finish();
+            return response;
+        }
+    }
+
+    // Only reuse the connection if the response was framed and nothing was sent after it.
+    keep_alive = parser.keep_alive() && connection.input.empty();
+    return response;
 }
 
-void HTTP::Servers::HTTPServer::HandleClients(int timeout) {
-    // Create a mutex for timeout.
-    std::shared_ptr<std::mutex> timeout_mutex = std::make_shared<std::mutex>();
-    // Create flag for timeout reached.
-    bool timeout_reached = 0;
-    if (timeout > 0) {
-        // If there is a timeout start a thread to sleep and then trigger timeout mutex.
-        std::thread sleep_thread([timeout,&timeout_reached,timeout_mutex]() {
-            // Sleep for timeout.
-            std::this_thread::sleep_for(std::chrono::seconds(timeout));
-
-            // Lock timeout mutex.
-            std::lock_guard<std::mutex> lock(*timeout_mutex);
-
-            // Set timeout reached flag to 1.
-            timeout_reached = 1;
-        });
-        // Will automatically close itself so no need to join.
-        sleep_thread.detach();
+HTTP::Responses::HTTPResponse HTTP::Clients::HTTPClient::Request(const std::string& ip, int port, HTTP::Requests::HTTPRequest& request) {
+    // Fill in the headers the server needs to read the request.
+    std::string key = ip + ":" + std::to_string(port);
+    if (!request.headers.get(HTTP::Requests::KnownHeader::Host)) {
+        request.headers.Set("Host", key);
+    }
+    if (!request.body.empty() && !request.headers.get(HTTP::Requests::KnownHeader::ContentLength) && !request.headers.get(HTTP::Requests::KnownHeader::TransferEncoding)) {
+        request.headers.Set("Content-Length", std::to_string(request.body.size()));
+    }
+    std::string raw = request.toString();
+    bool no_body = request.method == "HEAD";
+    bool idempotent = request.method == "GET" || request.method == "HEAD" || request.method == "PUT" || request.method == "DELETE" || request.method == "OPTIONS" || request.method == "TRACE";
+    stats.requests++;
+
+    while (true) {
+        // Use a pooled connection if there is one.
+        bool reused = false;
+        std::unique_ptr<HTTP::Clients::ClientConnection> connection = Acquire(ip, port, reused);
+        bool responded = false;
+        bool keep_alive = false;
+        try {
+            HTTP::Responses::HTTPResponse response = Exchange(*connection, raw, no_body, responded, keep_alive);
+            if (keep_alive) {
+                Release(key, std::move(connection));
+            }
+            return response;
+        } catch (const std::runtime_error& e) {
+            // A pooled connection the server already closed fails before any response, so send it again on another.
+            if (!reused || responded || !idempotent) {
+                throw;
+            }
+            stats.retried++;
+        }
     }
+}
 
-    // Create a lock
-    std::unique_lock<std::mutex> timeout_lock(*timeout_mutex, std::defer_lock);
-    // Lock timeout mutex so we can check.
-    timeout_lock.lock();
-    // Loop until the server stops running or the timeout is reached.
-    while (running == 1 && timeout_reached == 0) {
-        // Unlock the timeout mutex.
-        timeout_lock.unlock();
+HTTP::Responses::HTTPResponse HTTP::Clients::HTTPClient::Get(const std::string& ip, int port, const std::string& target) {
+    // Requests keep the host at the front of their url.
+    HTTP::Requests::HTTPRequest request("GET", ip + ":" + std::to_string(port) + target, std::map<std::string, std::string>(), "");
+    return Request(ip, port, request);
+}
 
-        // Handle the clients.
-        HandleClientsCycle();
+void HTTP::Clients::HTTPClient::CloseIdle() {
+    // Destroying the connections closes them.
+    idle.clear();
+}
 
-        // Lock the timeout mutex so we can check.
-        timeout_lock.lock();
+size_t HTTP::Clients::HTTPClient::idle_size() {
+    // Count across every server.
+    size_t count = 0;
+    for (const std::pair<const std::string, std::vector<std::unique_ptr<HTTP::Clients::ClientConnection>>>& pair : idle) {
+        count += pair.second.size();
     }
-}
\ No newline at end of file
+    return count;
+}
+
+HTTP::Clients::ClientStats HTTP::Clients::HTTPClient::get_stats() {
+    return stats;
+}
@@ -0,0 +1,157 @@
+#include "../../../include/networking/buffers/buffers.hpp"
+
+Buffers::SlabPool::SlabPool(size_t min_block, size_t max_block, size_t slab_size) {
+    // Check the sizes make sense.
+    if (min_block == 0 || (min_block & (min_block - 1)) != 0 || (max_block & (max_block - 1)) != 0 || max_block < min_block) {
+        throw std::invalid_argument("Block sizes must be powers of 2 with min_block no larger than max_block");
+    }
+    if (slab_size < max_block) {
+        throw std::invalid_argument("Slabs must fit at least one of the largest block");
+    }
+    this->min_block = min_block;
+    this->max_block = max_block;
+    this->slab_size = slab_size;
+    this->in_use = 0;
+
+    // One free list for each class.
+    this->free_blocks = std::vector<std::vector<char*>>(ClassOf(max_block) + 1);
+}
+
+Buffers::SlabPool::~SlabPool() {
+    // Slabs free themselves.
+    return;
+}
+
+size_t Buffers::SlabPool::ClassOf(size_t size) {
+    // Double from the smallest class until size fits.
+    size_t index = 0;
+    size_t block = min_block;
+    while (block < size) {
+        block <<= 1;
+        index++;
+    }
+    return index;
+}
+
+char* Buffers::SlabPool::Acquire(size_t size, size_t& capacity) {
+    // Blocks too big to pool come straight from the heap.
+    if (size > max_block) {
+        capacity = size;
+        in_use += capacity;
+        return new char[size];
+    }
+
+    // Reuse a free block of the right class.
+    size_t index = ClassOf(size);
+    capacity = min_block << index;
+    in_use += capacity;
+    std::vector<char*>& free_list = free_blocks[index];
+    if (!free_list.empty()) {
+        char* block = free_list.back();
+        free_list.pop_back();
+        return block;
+    }
+
+    // Otherwise carve a new slab into blocks of this class.
+    slabs.push_back(std::make_unique<char[]>(slab_size));
+    char* slab = slabs.back().get();
+    for (size_t offset = capacity; offset + capacity <= slab_size; offset += capacity) {
+        free_list.push_back(slab + offset);
+    }
+    return slab;
+}
+
+void Buffers::SlabPool::Release(char* block, size_t capacity) {
+    in_use -= capacity;
+
+    // Heap blocks go back to the heap.
+    if (capacity > max_block) {
+        delete[] block;
+        return;
+    }
+
+    // Pooled blocks go back on their free list.
+    free_blocks[ClassOf(capacity)].push_back(block);
+}
+
+size_t Buffers::SlabPool::get_in_use() {
+    return in_use;
+}
+
+Buffers::RecvBuffer::RecvBuffer(SlabPool& pool) : pool(&pool), block(nullptr), capacity(0), read_pos(0), write_pos(0) {}
+
+Buffers::RecvBuffer::~RecvBuffer() {
+    // Give the block back whatever is left in it.
+    if (block) {
+        pool->Release(block, capacity);
+    }
+}
+
+char* Buffers::RecvBuffer::Reserve(size_t size) {
+    // Use the space already free if there is enough.
+    if (capacity - write_pos >= size) {
+        return block + write_pos;
+    }
+
+    // Slide unread data to the front if that makes enough room.
+    if (capacity - (write_pos - read_pos) >= size) {
+        Compact();
+        return block + write_pos;
+    }
+
+    // Otherwise move to a block at least twice as big.
+    size_t unread = write_pos - read_pos;
+    size_t new_capacity;
+    char* new_block = pool->Acquire(std::max(unread + size, capacity * 2), new_capacity);
+    if (block) {
+        memcpy(new_block, block + read_pos, unread);
+        pool->Release(block, capacity);
+    }
+    block = new_block;
+    capacity = new_capacity;
+    read_pos = 0;
+    write_pos = unread;
+    return block + write_pos;
+}
+
+void Buffers::RecvBuffer::Commit(size_t size) {
+    write_pos += size;
+}
+
+void Buffers::RecvBuffer::Append(const char* bytes, size_t size) {
+    // Make room then copy.
+    memcpy(Reserve(size), bytes, size);
+    write_pos += size;
+}
+
+void Buffers::RecvBuffer::Consume(size_t size) {
+    read_pos += size;
+
+    // Start from the front again once everything is read so the block doesn't need compacting.
+    if (read_pos == write_pos) {
+        read_pos = 0;
+        write_pos = 0;
+    }
+}
+
+void Buffers::RecvBuffer::Compact() {
+    // Nothing to do if unread data already starts at the front.
+    if (read_pos == 0) {
+        return;
+    }
+    memmove(block, block + read_pos, write_pos - read_pos);
+    write_pos -= read_pos;
+    read_pos = 0;
+}
+
+void Buffers::RecvBuffer::Release() {
+    // Only let go of the block if nothing in it is still needed.
+    if (!block || read_pos != write_pos) {
+        return;
+    }
+    pool->Release(block, capacity);
+    block = nullptr;
+    capacity = 0;
+    read_pos = 0;
+    write_pos = 0;
+}
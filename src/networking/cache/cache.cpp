@@ -0,0 +1,679 @@
+#include "../../../include/networking/cache/cache.hpp"
+
+// Anything that can change what a file in a watched directory holds, or remove the directory itself.
+static constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+struct MediaType {
+    std::string_view extension;
+    std::string_view type;
+};
+
+static constexpr MediaType MEDIA_TYPES[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"js", "text/javascript"},
+    {"mjs", "text/javascript"},
+    {"json", "application/json"},
+    {"txt", "text/plain"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"}
+};
+
+std::string_view Cache::ContentType(std::string_view path) {
+    // The extension is whatever follows the last . in the file name.
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash)) {
+        return "text/html";
+    }
+    std::string_view extension = path.substr(dot + 1);
+
+    // Look it up ignoring case.
+    for (const MediaType& media : MEDIA_TYPES) {
+        if (media.extension.size() != extension.size()) {
+            continue;
+        }
+        bool equal = true;
+        for (size_t i = 0; i < extension.size() && equal; i++) {
+            equal = std::tolower(static_cast<unsigned char>(extension[i])) == media.extension[i];
+        }
+        if (equal) {
+            return media.type;
+        }
+    }
+    return "text/html";
+}
+
+bool Cache::Compressible(std::string_view type) {
+    // Text and the formats built on it shrink, images other than SVG, fonts and archives are already compressed.
+    return type.substr(0, 5) == "text/" || type == "application/json" || type == "application/xml" || type == "application/wasm" || type == "image/svg+xml";
+}
+
+static void put_digits(char* out, int value, int width) {
+    // Fill from the right, padding with zeros.
+    for (int i = width - 1; i >= 0; i--) {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+void Cache::FormatDate(time_t time, char* out) {
+    static constexpr char DAYS[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr char MONTHS[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    // Always in GMT and English, whatever the locale. Times gmtime can't represent come out as the epoch.
+    tm parts;
+    if (!gmtime_r(&time, &parts)) {
+        time = 0;
+        gmtime_r(&time, &parts);
+    }
+
+    // Write each field at its fixed place, the year is kept to four digits so the date is always 29 characters.
+    int year = parts.tm_year + 1900;
+    year = year < 0 ? 0 : (year > 9999 ? 9999 : year);
+    memcpy(out, DAYS[parts.tm_wday], 3);
+    memcpy(out + 3, ", ", 2);
+    put_digits(out + 5, parts.tm_mday, 2);
+    out[7] = ' ';
+    memcpy(out + 8, MONTHS[parts.tm_mon], 3);
+    out[11] = ' ';
+    put_digits(out + 12, year, 4);
+    out[16] = ' ';
+    put_digits(out + 17, parts.tm_hour, 2);
+    out[19] = ':';
+    put_digits(out + 20, parts.tm_min, 2);
+    out[22] = ':';
+    put_digits(out + 23, parts.tm_sec, 2);
+    memcpy(out + 25, " GMT", 5);
+}
+
+std::string Cache::EntityTag(const struct stat& info, std::string_view suffix) {
+    // Hex fields between quotes, the suffix names the encoding.
+    char tag[96];
+    int length = snprintf(tag, sizeof(tag), "\"%llx-%llx-%llx%09lx", static_cast<unsigned long long>(info.st_ino), static_cast<unsigned long long>(info.st_size), static_cast<unsigned long long>(info.st_mtim.tv_sec), static_cast<long>(info.st_mtim.tv_nsec));
+    std::string etag(tag, length);
+    if (!suffix.empty()) {
+        etag += '-';
+        etag.append(suffix.data(), suffix.size());
+    }
+    etag += '"';
+    return etag;
+}
+
+static std::string compress(std::string_view data, int window_bits) {
+    // Compress as hard as zlib can since it is done once per file, not per request.
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, window_bits, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib");
+    }
+    std::string compressed(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    int result = deflate(&stream, Z_FINISH);
+    size_t length = stream.total_out;
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("Failed to compress");
+    }
+    compressed.resize(length);
+    return compressed;
+}
+
+static std::string validator_lines(std::string_view etag, std::string_view last_modified) {
+    // The lines both a full and a 304 response carry.
+    std::string lines = "ETag: ";
+    lines.append(etag.data(), etag.size());
+    lines += "\r\nLast-Modified: ";
+    lines.append(last_modified.data(), last_modified.size());
+    lines += "\r\n";
+    return lines;
+}
+
+static void make_variant(Cache::Variant& variant, std::string_view data, int window_bits, std::string_view type, std::string_view coding, const struct stat& info, std::string_view last_modified) {
+    // Keep it only if it is smaller.
+    std::string compressed = compress(data, window_bits);
+    if (compressed.size() >= data.size()) {
+        return;
+    }
+    variant.data = std::move(compressed);
+
+    // A strong tag names exact bytes, so each encoding has its own.
+    variant.etag = Cache::EntityTag(info, coding);
+    variant.not_modified_block = validator_lines(variant.etag, last_modified) + "Vary: Accept-Encoding\r\n";
+    variant.header_block = "Content-Type: ";
+    variant.header_block.append(type.data(), type.size());
+    variant.header_block += "\r\nContent-Encoding: ";
+    variant.header_block.append(coding.data(), coding.size());
+    variant.header_block += "\r\nContent-Length: " + std::to_string(variant.data.size()) + "\r\n" + variant.not_modified_block;
+}
+
+static std::string directory_of(const std::string& path) {
+    // Everything before the last /, or the working directory if there isn't one.
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? std::string("/") : path.substr(0, slash);
+}
+
+// Epoch-based reclamation is shared by every cache, each thread announces the epoch it is reading in through a record of its own.
+static std::atomic<uint64_t> global_epoch{1};
+static std::atomic<Cache::EpochRecord*> epoch_records{nullptr};
+
+static Cache::EpochRecord* acquire_record() {
+    // Reuse a record a finished thread gave up.
+    for (Cache::EpochRecord* record = epoch_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+        bool expected = false;
+        if (!record->in_use.load(std::memory_order_relaxed) && record->in_use.compare_exchange_strong(expected, true)) {
+            return record;
+        }
+    }
+
+    // Otherwise push a new one, records are never freed so readers can walk the list without locking.
+    Cache::EpochRecord* record = new Cache::EpochRecord();
+    record->in_use.store(true, std::memory_order_relaxed);
+    record->next = epoch_records.load(std::memory_order_relaxed);
+    while (!epoch_records.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed)) {}
+    return record;
+}
+
+/**
+ * @struct ThreadRecord
+ * @brief Holds a thread's record and gives it back when the thread exits.
+ */
+struct ThreadRecord {
+    Cache::EpochRecord* record = acquire_record(); ///< The thread's record.
+
+    ~ThreadRecord() {
+        record->epoch.store(0, std::memory_order_relaxed);
+        record->in_use.store(false, std::memory_order_release);
+    }
+};
+
+static Cache::EpochRecord& thread_record() {
+    thread_local ThreadRecord local;
+    return *local.record;
+}
+
+Cache::EpochGuard::EpochGuard() : record(thread_record()) {
+    // Announce the epoch before reading anything it protects.
+    record.epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+Cache::EpochGuard::~EpochGuard() {
+    record.epoch.store(0, std::memory_order_release);
+}
+
+Cache::Entry::~Entry() {
+    // Unmap the contents.
+    if (mapping) {
+        munmap(mapping, mapping_length);
+    }
+}
+
+bool Cache::Entry::has(Cache::Encoding encoding) const {
+    // Identity is always there, a variant only if it was worth keeping.
+    switch (encoding) {
+        case Cache::Encoding::Gzip:
+            return !gzip.data.empty();
+        case Cache::Encoding::Deflate:
+            return !deflate.data.empty();
+        default:
+            return true;
+    }
+}
+
+std::string_view Cache::Entry::get_data(Cache::Encoding encoding) const {
+    switch (encoding) {
+        case Cache::Encoding::Gzip:
+            return gzip.data;
+        case Cache::Encoding::Deflate:
+            return deflate.data;
+        default:
+            return data;
+    }
+}
+
+const std::string& Cache::Entry::get_header_block(Cache::Encoding encoding) const {
+    switch (encoding) {
+        case Cache::Encoding::Gzip:
+            return gzip.header_block;
+        case Cache::Encoding::Deflate:
+            return deflate.header_block;
+        default:
+            return header_block;
+    }
+}
+
+const std::string& Cache::Entry::get_etag(Cache::Encoding encoding) const {
+    switch (encoding) {
+        case Cache::Encoding::Gzip:
+            return gzip.etag;
+        case Cache::Encoding::Deflate:
+            return deflate.etag;
+        default:
+            return etag;
+    }
+}
+
+const std::string& Cache::Entry::get_not_modified_block(Cache::Encoding encoding) const {
+    switch (encoding) {
+        case Cache::Encoding::Gzip:
+            return gzip.not_modified_block;
+        case Cache::Encoding::Deflate:
+            return deflate.not_modified_block;
+        default:
+            return not_modified_block;
+    }
+}
+
+size_t Cache::Entry::get_size() const {
+    return data.size() + gzip.data.size() + deflate.data.size();
+}
+
+Cache::ContentCache::ContentCache(size_t budget) : budget(budget), used(0), generation(0), shards(), clock(), hand(0), retired(), watches(), misses(0), evictions(0), invalidations(0), mutex() {
+    // Set up inotify and the eventfd that stops the watcher.
+    this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotify_fd < 0) {
+        throw std::runtime_error("Failed to initialize inotify");
+    }
+    this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wake_fd < 0) {
+        close(this->inotify_fd);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    // Start watching.
+    this->watcher = std::thread(&Cache::ContentCache::Watch, this);
+}
+
+Cache::ContentCache::~ContentCache() {
+    // Wake the watcher and wait for it to stop.
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+    watcher.join();
+
+    // Close fds.
+    close(inotify_fd);
+    close(wake_fd);
+
+    // Nothing can be reading once the cache is destroyed, so free every table.
+    for (Shard& shard : shards) {
+        delete shard.table.load(std::memory_order_relaxed);
+    }
+    for (const std::pair<uint64_t, const Table*>& table : retired) {
+        delete table.second;
+    }
+}
+
+std::shared_ptr<const Cache::Entry> Cache::ContentCache::Find(const std::string& path, size_t hash) {
+    // Probe the shard's table from the slot the hash picks until an empty slot.
+    const Table* table = shards[hash >> (sizeof(size_t) * 8 - SHARD_BITS)].table.load(std::memory_order_acquire);
+    if (!table) {
+        return nullptr;
+    }
+    size_t mask = table->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = table->slots[i];
+        if (!slot.entry) {
+            return nullptr;
+        }
+        if (slot.hash == hash && slot.entry->path == path) {
+            return slot.entry;
+        }
+    }
+}
+
+void Cache::ContentCache::Replace(size_t hash, const std::shared_ptr<const Cache::Entry>& entry, const std::string& path) {
+    // Size the copy to stay at most half full.
+    Shard& shard = shards[hash >> (sizeof(size_t) * 8 - SHARD_BITS)];
+    const Table* old = shard.table.load(std::memory_order_relaxed);
+    size_t count = (old ? old->count : 0) + (entry ? 1 : 0);
+    size_t capacity = 8;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    Table* table = new Table();
+    table->slots.resize(capacity);
+    auto insert = [table](size_t slot_hash, const std::shared_ptr<const Cache::Entry>& slot_entry) {
+        size_t mask = table->slots.size() - 1;
+        size_t i = slot_hash & mask;
+        while (table->slots[i].entry) {
+            i = (i + 1) & mask;
+        }
+        table->slots[i] = Slot{slot_hash, slot_entry};
+        table->count++;
+    };
+
+    // Copy everything but the path, then add the new entry.
+    if (old) {
+        for (const Slot& slot : old->slots) {
+            if (slot.entry && !(slot.hash == hash && slot.entry->path == path)) {
+                insert(slot.hash, slot.entry);
+            }
+        }
+    }
+    if (entry) {
+        insert(hash, entry);
+    }
+
+    // Publish it and retire the old one until no reader can see it.
+    shard.table.store(table, std::memory_order_release);
+    if (old) {
+        retired.push_back(std::make_pair(global_epoch.load(std::memory_order_acquire), old));
+    }
+    Reclaim();
+}
+
+void Cache::ContentCache::Reclaim() {
+    // Start a new epoch, readers that enter from now on can only see the published tables.
+    global_epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Find the oldest epoch a thread is still reading in.
+    uint64_t oldest = UINT64_MAX;
+    for (Cache::EpochRecord* record = epoch_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+        uint64_t epoch = record->epoch.load(std::memory_order_acquire);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    // Free tables retired before it.
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].first < oldest) {
+            delete retired[i].second;
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+void Cache::ContentCache::Drop(const std::shared_ptr<const Cache::Entry>& entry) {
+    // Keep the entry alive while it is unlinked.
+    std::shared_ptr<const Cache::Entry> dropped = entry;
+    Replace(std::hash<std::string>()(dropped->path), nullptr, dropped->path);
+
+    // Fill its place in the clock with the last entry.
+    size_t index = dropped->clock_index;
+    clock[index] = clock.back();
+    clock[index]->clock_index = index;
+    clock.pop_back();
+    if (hand >= clock.size()) {
+        hand = 0;
+    }
+    used -= dropped->get_size();
+}
+
+void Cache::ContentCache::Remove(const std::string& path) {
+    // Drop the entry if it is held.
+    std::shared_ptr<const Cache::Entry> entry = Find(path, std::hash<std::string>()(path));
+    if (entry) {
+        Drop(entry);
+        invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Cache::ContentCache::RemoveDirectory(const std::string& directory) {
+    // Check every entry, this only happens when a directory goes away.
+    std::vector<std::shared_ptr<const Cache::Entry>> dropped;
+    for (const std::shared_ptr<const Cache::Entry>& entry : clock) {
+        if (directory.empty() || directory_of(entry->path) == directory) {
+            dropped.push_back(entry);
+        }
+    }
+    for (const std::shared_ptr<const Cache::Entry>& entry : dropped) {
+        Drop(entry);
+    }
+    invalidations.fetch_add(dropped.size(), std::memory_order_relaxed);
+}
+
+void Cache::ContentCache::MakeRoom(size_t size) {
+    // Sweep until the bytes fit, giving entries hit since the hand last passed another lap.
+    while (used + size > budget && !clock.empty()) {
+        if (hand >= clock.size()) {
+            hand = 0;
+        }
+        if (clock[hand]->referenced.exchange(false, std::memory_order_relaxed)) {
+            hand++;
+            continue;
+        }
+
+        // The last entry takes the victim's place, so the hand stays put.
+        Drop(clock[hand]);
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Cache::ContentCache::Watch() {
+    alignas(inotify_event) char buffer[4096];
+    pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    while (true) {
+        // Sleep until something changes or the cache is destroyed.
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+
+        // Drop whatever the events touch.
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        for (char* position = buffer; position < buffer + length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            // Events were lost, so anything could have changed.
+            if (event->mask & IN_Q_OVERFLOW) {
+                RemoveDirectory(std::string());
+                continue;
+            }
+            std::unordered_map<int, std::string>::iterator watch = watches.find(event->wd);
+            if (watch == watches.end()) {
+                continue;
+            }
+
+            // The directory itself went away.
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                RemoveDirectory(watch->second);
+                if (event->mask & IN_IGNORED) {
+                    watches.erase(watch);
+                }
+                continue;
+            }
+
+            // A file in it changed, entries are keyed by the path as given so try it with and without the directory.
+            if (event->len != 0) {
+                std::string name(event->name);
+                Remove(watch->second == "/" ? "/" + name : watch->second + "/" + name);
+                if (watch->second == ".") {
+                    Remove(name);
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<const Cache::Entry> Cache::ContentCache::Get(const std::string& path) {
+    // Look the path up without locking.
+    size_t hash = std::hash<std::string>()(path);
+    {
+        Cache::EpochGuard guard;
+        std::shared_ptr<const Cache::Entry> entry = Find(path, hash);
+        if (entry) {
+            // Only write the bit when it changes, so hot entries aren't bounced between cores.
+            if (!entry->referenced.load(std::memory_order_relaxed)) {
+                entry->referenced.store(true, std::memory_order_relaxed);
+            }
+            shards[hash >> (sizeof(size_t) * 8 - SHARD_BITS)].hits.fetch_add(1, std::memory_order_relaxed);
+            return entry;
+        }
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+
+    // Watch the directory before reading, so a change made while reading is seen, a file that can't be watched isn't cached.
+    uint64_t seen;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string directory = directory_of(path);
+        int wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            return nullptr;
+        }
+        watches[wd] = directory;
+        seen = generation;
+    }
+
+    // Open the file and get its size.
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path);
+    }
+    size_t size = info.st_size;
+    if (size > budget) {
+        close(fd);
+        return nullptr;
+    }
+
+    // Copy it into an anonymous mapping rather than mapping the file itself, so truncating or rewriting the file can't fault or tear a response being sent.
+    std::shared_ptr<Cache::Entry> entry = std::make_shared<Cache::Entry>();
+    entry->path = path;
+    if (size != 0) {
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map " + path);
+        }
+        entry->mapping = mapping;
+        entry->mapping_length = size;
+
+        // Read until the end, a file that shrank since fstat is cut short and its change is caught by the generation check.
+        size_t filled = 0;
+        while (filled < size) {
+            ssize_t length = pread(fd, static_cast<char*>(mapping) + filled, size - filled, filled);
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            if (length < 0) {
+                close(fd);
+                throw std::runtime_error("Failed to read " + path);
+            }
+            if (length == 0) {
+                break;
+            }
+            filled += length;
+        }
+        mprotect(mapping, size, PROT_READ);
+        entry->data = std::string_view(static_cast<const char*>(mapping), filled);
+        size = filled;
+    }
+    close(fd);
+    entry->mtime = info.st_mtim;
+
+    // Compress text once for every response that accepts it.
+    char last_modified[30];
+    Cache::FormatDate(info.st_mtim.tv_sec, last_modified);
+    std::string_view type = Cache::ContentType(path);
+    if (size != 0 && Cache::Compressible(type)) {
+        make_variant(entry->gzip, entry->data, 15 + 16, type, "gzip", info, std::string_view(last_modified, 29));
+        make_variant(entry->deflate, entry->data, 15, type, "deflate", info, std::string_view(last_modified, 29));
+    }
+
+    // Describe it once for every response, saying it varies if there is a compressed variant to choose.
+    entry->etag = Cache::EntityTag(info, "");
+    entry->not_modified_block = validator_lines(entry->etag, std::string_view(last_modified, 29));
+    if (entry->has(Cache::Encoding::Gzip) || entry->has(Cache::Encoding::Deflate)) {
+        entry->not_modified_block += "Vary: Accept-Encoding\r\n";
+    }
+    entry->header_block = "Content-Type: ";
+    entry->header_block.append(type.data(), type.size());
+    entry->header_block += "\r\nContent-Length: " + std::to_string(size) + "\r\n" + entry->not_modified_block;
+
+    // Serve it uncached if its directory changed while reading or it doesn't fit with its variants, and share another thread's copy if it got there first.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != seen || entry->get_size() > budget) {
+        return entry;
+    }
+    std::shared_ptr<const Cache::Entry> existing = Find(path, hash);
+    if (existing) {
+        return existing;
+    }
+
+    // Evict until it fits then publish it.
+    MakeRoom(entry->get_size());
+    entry->clock_index = clock.size();
+    clock.push_back(entry);
+    Replace(hash, entry, path);
+    used += entry->get_size();
+    return entry;
+}
+
+void Cache::ContentCache::Clear() {
+    // Unpublish every table.
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Shard& shard : shards) {
+        const Table* old = shard.table.exchange(nullptr, std::memory_order_acq_rel);
+        if (old) {
+            retired.push_back(std::make_pair(global_epoch.load(std::memory_order_acquire), old));
+        }
+    }
+    clock.clear();
+    hand = 0;
+    used = 0;
+    Reclaim();
+}
+
+size_t Cache::ContentCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return clock.size();
+}
+
+size_t Cache::ContentCache::get_used() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+Cache::CacheStats Cache::ContentCache::get_stats() {
+    // Sum the hits from every shard.
+    std::lock_guard<std::mutex> lock(mutex);
+    Cache::CacheStats stats;
+    for (const Shard& shard : shards) {
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+    }
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.evictions = evictions.load(std::memory_order_relaxed);
+    stats.invalidations = invalidations.load(std::memory_order_relaxed);
+    stats.entries = clock.size();
+    stats.bytes = used;
+    return stats;
+}
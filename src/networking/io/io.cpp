@@ -0,0 +1,605 @@
+#include "../../../include/networking/io/io.hpp"
+
+// Operations packed into the top byte of io_uring user data.
+enum : uint8_t {
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_SEND = 3,
+    OP_POLLOUT = 4,
+    OP_WAKE = 5,
+    OP_IGNORE = 6
+};
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IO::EpollBackend::EpollBackend(int max_events) {
+    // Create an epoll_fd.
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+    this->listener_fd = -1;
+    this->wake_fd = -1;
+    this->events = std::vector<epoll_event>(max_events);
+}
+
+IO::EpollBackend::~EpollBackend() {
+    // Close epoll fd.
+    close(epoll_fd);
+}
+
+IO::BackendType IO::EpollBackend::get_type() {
+    return IO::BackendType::Epoll;
+}
+
+void IO::EpollBackend::AddListener(int fd) {
+    // Add the listener level-triggered so waiting clients keep it ready.
+    listener_fd = fd;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void IO::EpollBackend::AddWake(int fd) {
+    // Add the wake fd.
+    wake_fd = fd;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void IO::EpollBackend::AddClient(int fd) {
+    // Add client to events, edge-triggered so each event is only reported once.
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void IO::EpollBackend::RemoveClient(int fd) {
+    // Stop watching the fd.
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int IO::EpollBackend::Wait(std::vector<IO::Event>& ready, int timeout) {
+    ready.clear();
+
+    // Wait for events.
+    int num_events = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+
+    // Check for error.
+    if (num_events == -1) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+        }
+        return 0;
+    }
+
+    // Convert every epoll event, one client event can become several.
+    for (int i = 0; i < num_events; i++) {
+        int fd = events[i].data.fd;
+        uint32_t flags = events[i].events;
+        if (fd == listener_fd) {
+            ready.push_back(IO::Event{IO::Event::Accept, fd, 0, nullptr, -1});
+            continue;
+        }
+        if (fd == wake_fd) {
+            ready.push_back(IO::Event{IO::Event::Wake, fd, 0, nullptr, -1});
+            continue;
+        }
+        if (flags & (EPOLLERR | EPOLLHUP)) {
+            // Connection is broken so nothing more can be done with it.
+            ready.push_back(IO::Event{IO::Event::Hangup, fd, -ECONNRESET, nullptr, -1});
+            continue;
+        }
+        if (flags & (EPOLLIN | EPOLLRDHUP)) {
+            ready.push_back(IO::Event{IO::Event::Readable, fd, 0, nullptr, -1});
+        }
+        if (flags & EPOLLOUT) {
+            ready.push_back(IO::Event{IO::Event::Writable, fd, 0, nullptr, -1});
+        }
+        if (flags & EPOLLRDHUP) {
+            ready.push_back(IO::Event{IO::Event::Hangup, fd, 0, nullptr, -1});
+        }
+    }
+
+    return ready.size();
+}
+
+bool IO::EpollBackend::SendsAsync() {
+    return false;
+}
+
+void IO::EpollBackend::Send(int fd, const iovec* iov, int iovcnt, bool close_after) {
+    throw std::logic_error("Epoll backend does not send, write to the socket directly");
+}
+
+void IO::EpollBackend::WatchWritable(int fd) {
+    // Edge-triggered EPOLLOUT is already registered and fires once the socket drains.
+    return;
+}
+
+void IO::EpollBackend::ReleaseBuffer(int buffer_id) {
+    // Epoll never hands out buffers.
+    return;
+}
+
+void IO::EpollBackend::PauseReading(int fd) {
+    // Watch everything but EPOLLIN.
+    epoll_event event;
+    event.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void IO::EpollBackend::ResumeReading(int fd) {
+    // Modifying rechecks readiness, so data that arrived while paused is reported as a new edge.
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+IO::IOUringBackend::IOUringBackend(unsigned entries, unsigned buffer_count, unsigned buffer_size) {
+    // Check the buffer count is usable as a ring.
+    if (buffer_count == 0 || (buffer_count & (buffer_count - 1)) != 0 || buffer_count > 32768) {
+        throw std::invalid_argument("Buffer count must be a power of 2 no larger than 32768");
+    }
+
+    // Create the ring.
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+    this->ring_fd = io_uring_setup(entries, &params);
+    if (this->ring_fd < 0) {
+        throw std::runtime_error("Failed to create io_uring instance");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        close(this->ring_fd);
+        throw std::runtime_error("io_uring is missing required features");
+    }
+
+    // Map the rings, which share one mapping with IORING_FEAT_SINGLE_MMAP.
+    this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    this->sq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+    this->cq_ring_size = this->sq_ring_size;
+    this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+    if (this->sq_ring == MAP_FAILED) {
+        close(this->ring_fd);
+        throw std::runtime_error("Failed to map io_uring rings");
+    }
+    this->cq_ring = this->sq_ring;
+    this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    this->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES));
+    if (this->sqes == MAP_FAILED) {
+        munmap(this->sq_ring, this->sq_ring_size);
+        close(this->ring_fd);
+        throw std::runtime_error("Failed to map io_uring entries");
+    }
+
+    // Find the ring fields in the mapping.
+    char* sq = static_cast<char*>(this->sq_ring);
+    this->sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    this->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    this->sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    this->sq_entries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    this->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    this->sq_local_tail = *this->sq_tail;
+    char* cq = static_cast<char*>(this->cq_ring);
+    this->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    this->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    this->cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Create the buffer ring and the memory behind it.
+    this->buffer_count = buffer_count;
+    this->buffer_size = buffer_size;
+    this->buffer_ring_size = buffer_count * sizeof(io_uring_buf);
+    this->buffer_ring = static_cast<io_uring_buf_ring*>(mmap(nullptr, this->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    this->buffers = static_cast<char*>(mmap(nullptr, static_cast<size_t>(buffer_count) * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (this->buffer_ring == MAP_FAILED || this->buffers == MAP_FAILED) {
+        // Unmap whichever of the two did map.
+        if (this->buffer_ring != MAP_FAILED) {
+            munmap(this->buffer_ring, this->buffer_ring_size);
+        }
+        if (this->buffers != MAP_FAILED) {
+            munmap(this->buffers, static_cast<size_t>(buffer_count) * buffer_size);
+        }
+        munmap(this->sqes, this->sqes_size);
+        munmap(this->sq_ring, this->sq_ring_size);
+        close(this->ring_fd);
+        throw std::runtime_error("Failed to allocate io_uring buffers");
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(this->buffer_ring);
+    reg.ring_entries = buffer_count;
+    reg.bgid = 0;
+    if (io_uring_register(this->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(this->buffer_ring, this->buffer_ring_size);
+        munmap(this->buffers, static_cast<size_t>(buffer_count) * buffer_size);
+        munmap(this->sqes, this->sqes_size);
+        munmap(this->sq_ring, this->sq_ring_size);
+        close(this->ring_fd);
+        throw std::runtime_error("Failed to register io_uring buffer ring");
+    }
+
+    // Give every buffer to the kernel.
+    this->buffer_tail = 0;
+    for (unsigned i = 0; i < buffer_count; i++) {
+        ReleaseBuffer(i);
+    }
+
+    // Register a sparse file table so client n can use slot n, if the fd limit allows.
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    this->slots = std::vector<int>(std::min<rlim_t>(limit.rlim_cur, 65536), -1);
+    io_uring_rsrc_register files;
+    memset(&files, 0, sizeof(files));
+    files.nr = this->slots.size();
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    this->fixed_files = io_uring_register(this->ring_fd, IORING_REGISTER_FILES2, &files, sizeof(files)) == 0;
+
+    this->listener_fd = -1;
+    this->wake_fd = -1;
+}
+
+IO::IOUringBackend::~IOUringBackend() {
+    // Closing the ring cancels everything in flight, then unmap.
+    close(ring_fd);
+    munmap(buffer_ring, buffer_ring_size);
+    munmap(buffers, static_cast<size_t>(buffer_count) * buffer_size);
+    munmap(sqes, sqes_size);
+    munmap(sq_ring, sq_ring_size);
+}
+
+IO::BackendType IO::IOUringBackend::get_type() {
+    return IO::BackendType::IOUring;
+}
+
+io_uring_sqe* IO::IOUringBackend::GetSQE() {
+    // Make room if the ring is full.
+    while (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        Submit(0, 0);
+    }
+
+    // Take the next entry.
+    unsigned index = sq_local_tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sq_local_tail++;
+    return sqe;
+}
+
+int IO::IOUringBackend::Submit(unsigned wait_nr, int timeout) {
+    // Publish the queued entries.
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    // Submit, waiting with a timeout if one was given.
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (wait_nr > 0 && timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+        return io_uring_enter(ring_fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    }
+    return io_uring_enter(ring_fd, to_submit, wait_nr, flags, nullptr, 0);
+}
+
+uint64_t IO::IOUringBackend::Pack(uint8_t op, int fd) {
+    // Top byte is the op, then 24 bits of generation, then the fd.
+    uint32_t generation = (fd >= 0 && static_cast<size_t>(fd) < generations.size()) ? generations[fd] : 0;
+    return (static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(generation & 0xFFFFFF) << 32) | static_cast<uint32_t>(fd);
+}
+
+bool IO::IOUringBackend::IsFixed(int fd) {
+    return fixed_files && fd >= 0 && static_cast<size_t>(fd) < slots.size();
+}
+
+void IO::IOUringBackend::ArmAccept() {
+    // Accept clients already non-blocking and close-on-exec, repeating until cancelled.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = Pack(OP_ACCEPT, listener_fd);
+}
+
+void IO::IOUringBackend::ArmRecv(int fd) {
+    // Recieve into buffers picked from the ring, repeating until the client closes or buffers run out.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT | (IsFixed(fd) ? IOSQE_FIXED_FILE : 0);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    sqe->user_data = Pack(OP_RECV, fd);
+}
+
+void IO::IOUringBackend::ArmWake() {
+    // Poll the wake fd, repeating until cancelled.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = Pack(OP_WAKE, wake_fd);
+}
+
+void IO::IOUringBackend::AddListener(int fd) {
+    listener_fd = fd;
+    ArmAccept();
+}
+
+void IO::IOUringBackend::AddWake(int fd) {
+    wake_fd = fd;
+    ArmWake();
+}
+
+void IO::IOUringBackend::AddClient(int fd) {
+    // Start a new generation for the fd so completions for its last owner are dropped.
+    if (static_cast<size_t>(fd) >= generations.size()) {
+        generations.resize(fd + 1, 0);
+    }
+    generations[fd]++;
+    if (static_cast<size_t>(fd) >= paused.size()) {
+        paused.resize(fd + 1, false);
+    }
+    paused[fd] = false;
+
+    // Put the client in its file slot before the recv uses it.
+    if (IsFixed(fd)) {
+        slots[fd] = fd;
+        io_uring_sqe* sqe = GetSQE();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&slots[fd]);
+        sqe->len = 1;
+        sqe->off = fd;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = Pack(OP_IGNORE, fd);
+    }
+
+    // Start recieving.
+    ArmRecv(fd);
+}
+
+void IO::IOUringBackend::RemoveClient(int fd) {
+    // Cancel the recv.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = Pack(OP_RECV, fd);
+    sqe->user_data = Pack(OP_IGNORE, fd);
+
+    // Empty the file slot.
+    if (IsFixed(fd)) {
+        slots[fd] = -1;
+        sqe = GetSQE();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&slots[fd]);
+        sqe->len = 1;
+        sqe->off = fd;
+        sqe->user_data = Pack(OP_IGNORE, fd);
+    }
+
+    // Anything still in flight for this fd belongs to an old generation now.
+    if (static_cast<size_t>(fd) < generations.size()) {
+        generations[fd]++;
+    }
+}
+
+int IO::IOUringBackend::Wait(std::vector<IO::Event>& ready, int timeout) {
+    ready.clear();
+
+    // Submit queued work and wait unless completions are already waiting.
+    bool have_completions = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+    if (Submit((have_completions || timeout == 0) ? 0 : 1, timeout) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        perror("io_uring_enter");
+    }
+
+    // Loop over every completion.
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    // A client accepted here can reuse the fd of one whose linked close just finished, so start a new generation before looking at anything else so none of the old client's completions count as current.
+    for (unsigned index = head; index != tail; index++) {
+        io_uring_cqe* cqe = &cqes[index & cq_mask];
+        if ((cqe->user_data >> 56) == OP_ACCEPT && cqe->res >= 0) {
+            if (static_cast<size_t>(cqe->res) >= generations.size()) {
+                generations.resize(cqe->res + 1, 0);
+            }
+            generations[cqe->res]++;
+        }
+    }
+
+    for (; head != tail; head++) {
+        io_uring_cqe* cqe = &cqes[head & cq_mask];
+        uint8_t op = cqe->user_data >> 56;
+        uint32_t generation = (cqe->user_data >> 32) & 0xFFFFFF;
+        int fd = static_cast<int>(cqe->user_data & 0xFFFFFFFF);
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        bool current = static_cast<size_t>(fd) < generations.size() && (generations[fd] & 0xFFFFFF) == generation;
+
+        switch (op) {
+            case OP_ACCEPT:
+                // Hand out the new client and rearm if the multishot ended.
+                if (cqe->res >= 0) {
+                    ready.push_back(IO::Event{IO::Event::Accepted, cqe->res, 0, nullptr, -1});
+                }
+                if (!more) {
+                    ArmAccept();
+                }
+                break;
+            case OP_RECV: {
+                // Drop data for clients that have since been removed.
+                int buffer_id = (cqe->flags & IORING_CQE_F_BUFFER) ? static_cast<int>(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+                if (!current) {
+                    if (buffer_id >= 0) {
+                        ReleaseBuffer(buffer_id);
+                    }
+                    break;
+                }
+                if (cqe->res > 0 && buffer_id >= 0) {
+                    ready.push_back(IO::Event{IO::Event::Data, fd, cqe->res, buffers + static_cast<size_t>(buffer_id) * buffer_size, buffer_id});
+                    if (!more && !paused[fd]) {
+                        ArmRecv(fd);
+                    }
+                } else if (cqe->res == -ECANCELED) {
+                    // Reading was paused.
+                } else if (cqe->res == -ENOBUFS) {
+                    // Every buffer is in use, try again once they are released unless reading was paused meanwhile.
+                    if (!paused[fd]) {
+                        ArmRecv(fd);
+                    }
+                } else if (cqe->res <= 0) {
+                    ready.push_back(IO::Event{IO::Event::Hangup, fd, cqe->res, nullptr, -1});
+                }
+                break;
+            }
+            case OP_SEND:
+                // Free the message and report how much went out.
+                sends.erase(cqe->user_data);
+                if (current) {
+                    ready.push_back(IO::Event{IO::Event::Sent, fd, cqe->res, nullptr, -1});
+                }
+                break;
+            case OP_POLLOUT:
+                if (current) {
+                    ready.push_back(IO::Event{IO::Event::Writable, fd, 0, nullptr, -1});
+                }
+                break;
+            case OP_WAKE:
+                ready.push_back(IO::Event{IO::Event::Wake, fd, 0, nullptr, -1});
+                if (!more) {
+                    ArmWake();
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return ready.size();
+}
+
+bool IO::IOUringBackend::SendsAsync() {
+    return true;
+}
+
+void IO::IOUringBackend::Send(int fd, const iovec* iov, int iovcnt, bool close_after) {
+    // Keep the message alive until the send completes.
+    uint64_t user_data = Pack(OP_SEND, fd);
+    SendState& state = sends[user_data];
+    state.iov.assign(iov, iov + iovcnt);
+    memset(&state.message, 0, sizeof(state.message));
+    state.message.msg_iov = state.iov.data();
+    state.message.msg_iovlen = state.iov.size();
+
+    // Queue the send, waiting for all of it when the close is linked so a short send breaks the chain.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&state.message);
+    sqe->msg_flags = MSG_NOSIGNAL | (close_after ? MSG_WAITALL : 0);
+    sqe->flags = (IsFixed(fd) ? IOSQE_FIXED_FILE : 0) | (close_after ? IOSQE_IO_LINK : 0);
+    sqe->user_data = user_data;
+    if (!close_after) {
+        return;
+    }
+
+    // Shut down, empty the file slot and close, each only if the one before succeeded.
+    sqe = GetSQE();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = (IsFixed(fd) ? IOSQE_FIXED_FILE : 0) | IOSQE_IO_LINK;
+    sqe->user_data = Pack(OP_IGNORE, fd);
+    if (IsFixed(fd)) {
+        slots[fd] = -1;
+        sqe = GetSQE();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&slots[fd]);
+        sqe->len = 1;
+        sqe->off = fd;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = Pack(OP_IGNORE, fd);
+    }
+    sqe = GetSQE();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = Pack(OP_IGNORE, fd);
+}
+
+void IO::IOUringBackend::WatchWritable(int fd) {
+    // One shot poll for the socket draining.
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->flags = IsFixed(fd) ? IOSQE_FIXED_FILE : 0;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = Pack(OP_POLLOUT, fd);
+}
+
+void IO::IOUringBackend::ReleaseBuffer(int buffer_id) {
+    // Put the buffer back at the tail of the ring, indexed by hand since the flexible bufs member is offset in C++.
+    io_uring_buf* buffer = reinterpret_cast<io_uring_buf*>(buffer_ring) + (buffer_tail & (buffer_count - 1));
+    buffer->addr = reinterpret_cast<uint64_t>(buffers + static_cast<size_t>(buffer_id) * buffer_size);
+    buffer->len = buffer_size;
+    buffer->bid = buffer_id;
+    buffer_tail++;
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+}
+
+void IO::IOUringBackend::PauseReading(int fd) {
+    // Cancel the recv, and remember not to rearm it if it ends some other way first.
+    paused[fd] = true;
+    io_uring_sqe* sqe = GetSQE();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = Pack(OP_RECV, fd);
+    sqe->user_data = Pack(OP_IGNORE, fd);
+}
+
+void IO::IOUringBackend::ResumeReading(int fd) {
+    // Start recieving again, the cancel was queued first so it can't hit this recv.
+    paused[fd] = false;
+    ArmRecv(fd);
+}
+
+std::unique_ptr<IO::Backend> IO::CreateBackend(IO::BackendType type) {
+    // Try io_uring if asked for.
+    if (type == IO::BackendType::IOUring) {
+        try {
+            return std::make_unique<IO::IOUringBackend>();
+        } catch (const std::runtime_error& e) {
+            // Fall back to epoll, callers can tell from get_type.
+        }
+    }
+
+    return std::make_unique<IO::EpollBackend>();
+}
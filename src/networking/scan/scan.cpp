@@ -0,0 +1,180 @@
+#include "../../../include/networking/scan/scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+Scan::CharClass::CharClass(std::initializer_list<std::pair<uint8_t, uint8_t>> member_ranges) {
+    // Mark every member.
+    this->members.fill(false);
+    for (const std::pair<uint8_t, uint8_t>& range : member_ranges) {
+        for (int c = range.first; c <= range.second; c++) {
+            this->members[c] = true;
+        }
+    }
+
+    // The nibble tables only cover ASCII so the rest must be all in or all out.
+    this->high_members = this->members[0x80];
+    for (int c = 0x80; c < 256; c++) {
+        if (this->members[c] != this->high_members) {
+            throw std::invalid_argument("Bytes 0x80 to 0xFF must all be members or all not be");
+        }
+    }
+
+    // Build the nibble table from the ASCII members.
+    this->low_nibbles.fill(0);
+    for (int c = 0; c < 0x80; c++) {
+        if (this->members[c]) {
+            this->low_nibbles[c & 0x0F] |= 1 << (c >> 4);
+        }
+    }
+
+    // Collect the runs of non-members.
+    std::vector<std::pair<int, int>> runs;
+    for (int c = 0; c < 256; c++) {
+        if (this->members[c]) {
+            continue;
+        }
+        if (!runs.empty() && runs.back().second == c - 1) {
+            runs.back().second = c;
+        } else {
+            runs.push_back(std::make_pair(c, c));
+        }
+    }
+
+    // pcmpestri takes at most 8 ranges, so merge the closest runs until they fit, members caught by a merge are checked again after.
+    while (runs.size() > 8) {
+        size_t closest = 0;
+        for (size_t i = 1; i + 1 < runs.size(); i++) {
+            if (runs[i + 1].first - runs[i].second < runs[closest + 1].first - runs[closest].second) {
+                closest = i;
+            }
+        }
+        runs[closest].second = runs[closest + 1].second;
+        runs.erase(runs.begin() + closest + 1);
+    }
+    this->ranges.fill(0);
+    this->range_length = static_cast<int>(runs.size() * 2);
+    for (size_t i = 0; i < runs.size(); i++) {
+        this->ranges[i * 2] = static_cast<uint8_t>(runs[i].first);
+        this->ranges[i * 2 + 1] = static_cast<uint8_t>(runs[i].second);
+    }
+}
+
+const Scan::CharClass& Scan::Token() {
+    // The tchar rule: letters, digits and !#$%&'*+-.^_`|~
+    static const Scan::CharClass token({{'!', '!'}, {'#', '\''}, {'*', '+'}, {'-', '.'}, {'0', '9'}, {'A', 'Z'}, {'^', 'z'}, {'|', '|'}, {'~', '~'}});
+    return token;
+}
+
+const Scan::CharClass& Scan::FieldValue() {
+    // Tab, visible characters, spaces and obsolete non-ASCII text.
+    static const Scan::CharClass field_value({{'\t', '\t'}, {' ', '~'}, {0x80, 0xFF}});
+    return field_value;
+}
+
+const Scan::CharClass& Scan::Visible() {
+    static const Scan::CharClass visible({{'!', '~'}});
+    return visible;
+}
+
+static size_t find_not_in_scalar(const char* data, size_t length, const Scan::CharClass& members) {
+    // Check one byte at a time.
+    size_t i = 0;
+    while (i < length && members.contains(data[i])) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse4.2")))
+static size_t find_not_in_sse42(const char* data, size_t length, const Scan::CharClass& members) {
+    // Look for a byte in any of the non-member ranges 16 at a time.
+    __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(members.ranges.data()));
+    size_t i = 0;
+    while (i + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int index = _mm_cmpestri(ranges, members.range_length, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index == 16) {
+            i += 16;
+            continue;
+        }
+
+        // Stop unless the byte was only caught by merging ranges.
+        i += index;
+        if (!members.contains(data[i])) {
+            return i;
+        }
+        i++;
+    }
+
+    // Finish the tail one byte at a time.
+    return i + find_not_in_scalar(data + i, length - i, members);
+}
+
+__attribute__((target("avx2")))
+static size_t find_not_in_avx2(const char* data, size_t length, const Scan::CharClass& members) {
+    // A byte is a member if the bit for its high nibble is set in the table entry for its low nibble.
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(members.low_nibbles.data())));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0));
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i + 32 <= length) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(chunk, nibble));
+        __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+        uint32_t member_mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(low, high), zero)));
+
+        // Bytes 0x80 and up have the sign bit set and are all in or all out.
+        if (members.high_members) {
+            member_mask |= static_cast<uint32_t>(_mm256_movemask_epi8(chunk));
+        }
+        if (member_mask != 0xFFFFFFFF) {
+            return i + __builtin_ctz(~member_mask);
+        }
+        i += 32;
+    }
+
+    // Finish the tail one byte at a time.
+    return i + find_not_in_scalar(data + i, length - i, members);
+}
+#endif
+
+Scan::Level Scan::get_supported_level() {
+#ifdef SCAN_X86
+    // Ask the CPU once.
+    static const Scan::Level supported = __builtin_cpu_supports("avx2") ? Scan::Level::AVX2 : __builtin_cpu_supports("sse4.2") ? Scan::Level::SSE42 : Scan::Level::Scalar;
+    return supported;
+#else
+    return Scan::Level::Scalar;
+#endif
+}
+
+static Scan::Level current_level = Scan::get_supported_level();
+
+Scan::Level Scan::get_level() {
+    return current_level;
+}
+
+Scan::Level Scan::set_level(Scan::Level level) {
+    // Don't go above what the CPU can run.
+    current_level = std::min(level, get_supported_level());
+    return current_level;
+}
+
+size_t Scan::FindNotIn(const char* data, size_t length, const Scan::CharClass& members) {
+    // Use the level chosen.
+    switch (current_level) {
+#ifdef SCAN_X86
+        case Scan::Level::AVX2:
+            return find_not_in_avx2(data, length, members);
+        case Scan::Level::SSE42:
+            return find_not_in_sse42(data, length, members);
+#endif
+        default:
+            return find_not_in_scalar(data, length, members);
+    }
+}
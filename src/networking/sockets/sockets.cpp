@@ -1,5 +1,17 @@
 #include "../../../include/networking/sockets/sockets.hpp"
 
+static void wait_for(int fd, short events) {
+    // Setup poll structure for the one fd.
+    pollfd pfd = {fd, events, 0};
+
+    // Wait until the fd is ready, retrying if interrupted by a signal.
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error("Failed to poll socket");
+        }
+    }
+}
+
 Sockets::Socket::Socket(int domain, int type, sockaddr& addr) {
     // Create socket and check for error.
     this->fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -37,8 +49,10 @@ Sockets::Socket::Socket() {
 }
 
 Sockets::Socket::~Socket() {
-    // Close file descriptor.
-    close(fd);
+    // Close file descriptor if it is still owned.
+    if (fd >= 0) {
+        close(fd);
+    }
 }
 
 int Sockets::Socket::Bind() {
@@ -79,15 +93,42 @@ std::shared_ptr<Sockets::Socket> Sockets::Socket::Accept() {
     return client;
 }
 
+size_t Sockets::Socket::AcceptBatch(std::vector<std::shared_ptr<Socket>>& accepted) {
+    // Keep accepting until the backlog is empty.
+    size_t count = 0;
+    while (true) {
+        // Initialize client address to 0 and client address length.
+        sockaddr_in client_addr = {0, 0, 0, 0};
+        socklen_t client_addr_len = sizeof(client_addr);
+        // Accept client already non-blocking so no fcntl is needed.
+        int client_fd = accept4(get_fd(), (struct sockaddr*)&client_addr, &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            // Backlog is drained.
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            // Client went away before we got to it or a signal interrupted, try the next one.
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw std::runtime_error("Failed to accept client");
+        }
+        // Add client to the batch.
+        accepted.push_back(std::make_shared<Socket>(client_fd, domain, type, reinterpret_cast<sockaddr&>(client_addr)));
+        count++;
+    }
+
+    return count;
+}
+
 int Sockets::Socket::Connect(int other_domain, int other_port, std::string other_ip) {
     // Initialize server address to 0.
     sockaddr_in server_addr = {0, 0, 0, 0};
     // Copy in data.
     server_addr.sin_family = other_domain;
     server_addr.sin_port = htons(other_port);
-    if (inet_pton(other_domain, other_ip.c_str(), &server_addr.sin_addr) < 0) {
-        throw std::runtime_error("Failed to convert ip string into network byte order");
-        return -1;
+    if (inet_pton(other_domain, other_ip.c_str(), &server_addr.sin_addr) <= 0) {
+        throw std::invalid_argument("Invalid address " + other_ip);
     }
 
     // Connect to server.
@@ -104,34 +145,80 @@ int Sockets::Socket::Send(Socket& socket, std::string& message) {
         throw std::invalid_argument("Message is empty");
     }
 
-    // Loop over message 1024 bytes at a time and send.
-    ssize_t bytes_send = 0;
-    while ((bytes_send += send(socket.get_fd(), message.substr(bytes_send, 1024).c_str(), 1024, 0)) > 0) {
-        // Check if message is fully sent.
-        if (bytes_send >= message.size()) {
-            break;
+    // Send the whole message as a single buffer.
+    return SendV(socket, {iovec{const_cast<char*>(message.data()), message.size()}});
+}
+
+int Sockets::Socket::SendV(Socket& socket, std::vector<iovec> iov) {
+    // Loop until every buffer has been sent.
+    size_t index = 0;
+    while (index < iov.size()) {
+        // Skip empty buffers.
+        if (iov[index].iov_len == 0) {
+            index++;
+            continue;
         }
-    }
 
-    if (bytes_send < 0) {
-        throw std::runtime_error("Failed to send message");
+        // Send what the socket will take without copying the buffers.
+        msghdr message = {};
+        message.msg_iov = iov.data() + index;
+        message.msg_iovlen = std::min<size_t>(iov.size() - index, IOV_MAX);
+        ssize_t sent = sendmsg(socket.get_fd(), &message, MSG_NOSIGNAL);
+
+        // Check for errors, if the socket is non-blocking wait until it can be written to.
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_for(socket.get_fd(), POLLOUT);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to send message");
+        }
+
+        // Skip past whatever was sent, resuming partway through a buffer if needed.
+        size_t remaining = sent;
+        while (index < iov.size() && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            index++;
+        }
+        if (index < iov.size()) {
+            iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + remaining;
+            iov[index].iov_len -= remaining;
+        }
     }
 
     return 0;
 }
 
 std::string Sockets::Socket::Recv(Socket& socket) {
-    // Create full string to hold message and 1024 byte buffer.
+    // Create full string to hold message.
     std::string message;
-    char buffer[1024] = {0};
 
-    // Read the message in 1024 byte chunks.
+    // Read the message straight into the end of the string in 4096 byte chunks.
     ssize_t bytes_read = 0;
-    while ((bytes_read = recv(socket.get_fd(), buffer, sizeof(buffer), 0)) > 0) {
-        // Add buffer to message.
-        message.append(buffer, bytes_read);
-        // Check if message is fully read.
-        if (message.find('\n') != std::string::npos) {
+    size_t length = 0;
+    while (true) {
+        message.resize(length + 4096);
+        bytes_read = recv(socket.get_fd(), &message[length], 4096, 0);
+        if (bytes_read == 0) {
+            break;
+        }
+        // If the socket is non-blocking wait for data to arrive before trying again.
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_for(socket.get_fd(), POLLIN);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        // Check if message is fully read, only looking at the new bytes.
+        length += bytes_read;
+        if (memchr(&message[length - bytes_read], '\n', bytes_read) != nullptr) {
             break;
         }
     }
@@ -141,44 +228,243 @@ std::string Sockets::Socket::Recv(Socket& socket) {
         throw std::runtime_error("Failed to recieve message");
     }
 
-    // Resize message to correct size.
-    message.resize(bytes_read);
+    // Resize message to the bytes actually read.
+    message.resize(length);
 
     return message;
 }
 
 std::string Sockets::Socket::RecvInst(Socket& socket) {
-    // Create full string to hold message and 1024 byte buffer.
+    // Create full string to hold message.
     std::string message;
-    char buffer[1024] = {0};
 
-    // Read the message in 1024 byte chunks without waiting.
+    // Read the message straight into the end of the string in 4096 byte chunks without waiting.
     ssize_t bytes_read = 0;
-    while ((bytes_read = recv(socket.get_fd(), buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
-        // Add buffer to message.
-        message.append(buffer, bytes_read);
-        // Check if message is fully read.
-        if (message.find('\n') != std::string::npos) {
+    size_t length = 0;
+    while (true) {
+        message.resize(length + 4096);
+        bytes_read = recv(socket.get_fd(), &message[length], 4096, MSG_DONTWAIT);
+        if (bytes_read <= 0) {
+            break;
+        }
+        // Check if message is fully read, only looking at the new bytes.
+        length += bytes_read;
+        if (memchr(&message[length - bytes_read], '\n', bytes_read) != nullptr) {
             break;
         }
     }
 
-    // Check for errors.
-    if (bytes_read < 0) {
+    // Check for errors, no data waiting is not an error here.
+    if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
         throw std::runtime_error("Failed to recieve message nonblock");
     }
 
-    // Resize message to correct size.
-    message.resize(bytes_read);
+    // Resize message to the bytes actually read.
+    message.resize(length);
 
     return message;
 }
 
+ssize_t Sockets::Socket::RecvAvailable(Socket& socket, Buffers::RecvBuffer& buffer, bool& closed, size_t limit) {
+    ssize_t total = 0;
+    closed = false;
+
+    // Keep reading straight into the buffer until the kernel has nothing left for us or the limit is reached.
+    while (static_cast<size_t>(total) < limit) {
+        char* space = buffer.Reserve(std::min<size_t>(4096, limit - total));
+        ssize_t bytes_read = recv(socket.get_fd(), space, std::min<size_t>(buffer.get_free(), limit - total), MSG_DONTWAIT);
+        if (bytes_read > 0) {
+            buffer.Commit(bytes_read);
+            total += bytes_read;
+            continue;
+        }
+        if (bytes_read == 0) {
+            // Other side has shut down.
+            closed = true;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Drained everything waiting.
+            break;
+        }
+        throw std::runtime_error("Failed to recieve message nonblock");
+    }
+
+    return total;
+}
+
+ssize_t Sockets::Socket::SendAvailable(Socket& socket, const char* data, size_t length) {
+    // Send as a single buffer.
+    iovec iov = {const_cast<char*>(data), length};
+    return SendVAvailable(socket, &iov, 1);
+}
+
+ssize_t Sockets::Socket::SendVAvailable(Socket& socket, const iovec* iov, int iovcnt, bool more) {
+    // Send until the send buffer is full, sendmsg already writes as much as it can in one call.
+    msghdr message = {};
+    message.msg_iov = const_cast<iovec*>(iov);
+    message.msg_iovlen = std::min(iovcnt, IOV_MAX);
+    while (true) {
+        ssize_t sent = sendmsg(socket.get_fd(), &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (sent >= 0) {
+            return sent;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        throw std::runtime_error("Failed to send message");
+    }
+}
+
+static ssize_t splice_file(int socket_fd, int file_fd, off_t offset, size_t length) {
+    // Keep one pipe per thread to splice through.
+    static thread_local int pipe_fds[2] = {-1, -1};
+    if (pipe_fds[0] < 0 && pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Failed to create splice pipe");
+    }
+
+    // Go a pipe's worth at a time until it is all sent or the socket is full, so edge-triggered epoll reports it writable again.
+    ssize_t total = 0;
+    while (static_cast<size_t>(total) < length) {
+        // Move file pages into the pipe.
+        loff_t file_offset = offset + total;
+        ssize_t in_pipe = splice(file_fd, &file_offset, pipe_fds[1], nullptr, length - total, SPLICE_F_MOVE);
+        if (in_pipe <= 0) {
+            return total > 0 ? total : in_pipe;
+        }
+
+        // Move them out to the socket without waiting for it.
+        ssize_t sent = 0;
+        while (sent < in_pipe) {
+            ssize_t moved = splice(pipe_fds[0], nullptr, socket_fd, nullptr, in_pipe - sent, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved < 0) {
+                // The pipe is shared, so empty it of what the socket didn't take, the caller reads it from the file again from where total leaves off.
+                int error = errno;
+                char discard[4096];
+                while (read(pipe_fds[0], discard, sizeof(discard)) > 0) {}
+                total += sent;
+                if ((error == EAGAIN || error == EWOULDBLOCK) && total > 0) {
+                    return total;
+                }
+                errno = error;
+                return -1;
+            }
+            sent += moved;
+        }
+        total += sent;
+    }
+
+    return total;
+}
+
+int Sockets::Socket::SendFile(Socket& socket, int file_fd, off_t offset, size_t length) {
+    // Loop until the whole range is sent.
+    while (length > 0) {
+        ssize_t sent = SendFileAvailable(socket, file_fd, offset, length);
+        if (sent == 0) {
+            // Socket is full so wait until it can be written to.
+            wait_for(socket.get_fd(), POLLOUT);
+            continue;
+        }
+        offset += sent;
+        length -= sent;
+    }
+
+    return 0;
+}
+
+ssize_t Sockets::Socket::SendFileAvailable(Socket& socket, int file_fd, off_t offset, size_t length) {
+    // Send straight from the page cache without copying into user space.
+    while (true) {
+        off_t file_offset = offset;
+        ssize_t sent = sendfile(socket.get_fd(), file_fd, &file_offset, length);
+        if (sent > 0) {
+            return sent;
+        }
+        if (sent == 0) {
+            throw std::runtime_error("File ended before it was fully sent");
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        // The file doesn't support sendfile so splice through a pipe instead.
+        if (errno == EINVAL || errno == ENOSYS) {
+            ssize_t spliced = splice_file(socket.get_fd(), file_fd, offset, length);
+            if (spliced < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return 0;
+            }
+            if (spliced <= 0) {
+                throw std::runtime_error("Failed to splice file");
+            }
+            return spliced;
+        }
+        throw std::runtime_error("Failed to send file");
+    }
+}
+
+int Sockets::Socket::SetNonBlocking() {
+    // Get current flags and add O_NONBLOCK.
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Failed to set socket to non-blocking");
+    }
+    return 0;
+}
+
+int Sockets::Socket::SetReusePort() {
+    // Set SO_REUSEPORT so the kernel can spread connections over every listener.
+    int reuse = 1;
+    if (setsockopt(this->fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+        throw std::runtime_error("Failed to set SO_REUSEPORT on socket");
+    }
+    return 0;
+}
+
+int Sockets::Socket::AttachCPUSteering(int group_size) {
+    // Check for an invalid group.
+    if (group_size <= 0) {
+        throw std::invalid_argument("Group size must be positive");
+    }
+
+    // Load the current CPU, wrap it to the group size and return it as the listener index.
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<__u32>(group_size)},
+        {BPF_RET | BPF_A, 0, 0, 0}
+    };
+    sock_fprog program = {static_cast<unsigned short>(sizeof(code) / sizeof(code[0])), code};
+
+    // Attach to the group.
+    if (setsockopt(this->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        throw std::runtime_error("Failed to attach SO_REUSEPORT CBPF program");
+    }
+    return 0;
+}
+
 int Sockets::Socket::get_fd() {
     // Give fd out.
     return fd;
 }
 
+int Sockets::Socket::Release() {
+    // Hand the fd over and forget it.
+    int released = fd;
+    fd = -1;
+    return released;
+}
+
 std::shared_ptr<sockaddr> Sockets::Socket::get_addr() {
     // Give addr out.
     return addr;
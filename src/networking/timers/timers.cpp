@@ -0,0 +1,143 @@
+#include "../../../include/networking/timers/timers.hpp"
+
+uint64_t Timers::Now() {
+    // Use the monotonic clock so deadlines don't jump with the wall clock.
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Timers::Timer::~Timer() {
+    Cancel();
+}
+
+void Timers::Timer::Cancel() {
+    // Nothing to do if not armed.
+    if (!wheel) {
+        return;
+    }
+
+    // Unlink from the slot.
+    prev->next = next;
+    next->prev = prev;
+    prev = nullptr;
+    next = nullptr;
+    wheel->count--;
+    wheel = nullptr;
+}
+
+Timers::TimingWheel::TimingWheel(uint64_t tick_ms, uint64_t now) : slots(LEVELS * SLOTS) {
+    // Check the tick is usable.
+    if (tick_ms == 0) {
+        throw std::invalid_argument("Tick must be at least 1 millisecond");
+    }
+    this->tick_ms = tick_ms;
+    this->current = now / tick_ms;
+    this->count = 0;
+
+    // Every slot starts as an empty circular list.
+    for (Timer& slot : slots) {
+        slot.prev = &slot;
+        slot.next = &slot;
+    }
+}
+
+Timers::TimingWheel::~TimingWheel() {
+    // Disarm every timer so they don't touch the slots once they are gone.
+    for (Timer& slot : slots) {
+        while (slot.next != &slot) {
+            slot.next->Cancel();
+        }
+    }
+}
+
+void Timers::TimingWheel::Place(Timer& timer) {
+    // Pick the lowest level whose range covers the time left, clamping to the range of the wheel.
+    uint64_t delta = timer.expires - current;
+    uint64_t max_delta = (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    if (delta > max_delta) {
+        delta = max_delta;
+        timer.expires = current + delta;
+    }
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    // Link at the end of the slot's list.
+    Timer& head = Slot(level, (timer.expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+void Timers::TimingWheel::Arm(Timer& timer, uint64_t deadline) {
+    // Take the timer out of wherever it was.
+    timer.Cancel();
+
+    // Round up to a tick, at least one ahead since the current tick was already processed.
+    timer.expires = std::max((deadline + tick_ms - 1) / tick_ms, current + 1);
+    Place(timer);
+    timer.wheel = this;
+    count++;
+}
+
+void Timers::TimingWheel::Advance(uint64_t now, std::vector<Timer*>& expired) {
+    // Process every tick up to now.
+    uint64_t target = now / tick_ms;
+    while (current < target) {
+        // Skip straight to now when nothing is armed.
+        if (count == 0) {
+            current = target;
+            break;
+        }
+        current++;
+
+        // Find the highest level whose slot starts at this tick.
+        int top = 0;
+        while (top < LEVELS - 1 && (current & ((1ULL << (SLOT_BITS * (top + 1))) - 1)) == 0) {
+            top++;
+        }
+
+        // Cascade from the top down, so timers can fall through several levels to this tick.
+        for (int level = top; level > 0; level--) {
+            Timer& head = Slot(level, (current >> (SLOT_BITS * level)) & (SLOTS - 1));
+            Timer* timer = head.next;
+            head.prev = &head;
+            head.next = &head;
+            while (timer != &head) {
+                Timer* next = timer->next;
+                Place(*timer);
+                timer = next;
+            }
+        }
+
+        // Fire everything in this tick's slot.
+        Timer& head = Slot(0, current & (SLOTS - 1));
+        while (head.next != &head) {
+            Timer* timer = head.next;
+            timer->Cancel();
+            expired.push_back(timer);
+        }
+    }
+}
+
+int Timers::TimingWheel::NextTimeout(uint64_t now) {
+    // Nothing to wait for.
+    if (count == 0) {
+        return -1;
+    }
+
+    // Find the next tick with timers in the lowest level, stopping where the next level cascades.
+    uint64_t tick = current + 1;
+    while ((tick & (SLOTS - 1)) != 0 && Slot(0, tick & (SLOTS - 1)).next == &Slot(0, tick & (SLOTS - 1))) {
+        tick++;
+    }
+
+    // Convert to milliseconds from now.
+    uint64_t at = tick * tick_ms;
+    return at > now ? static_cast<int>(at - now) : 0;
+}
+
+size_t Timers::TimingWheel::size() {
+    return count;
+}